@@ -0,0 +1,119 @@
+/*
+ * arena.h
+ *
+ * A bump-pointer allocator for memory that is all released at once.
+ *
+ * An Arena hands out memory from large blocks by moving a pointer; nothing
+ * is freed on its own. reset() makes all of it available again (keeping the
+ * blocks), and destroying the Arena gives the blocks back. That suits
+ * memory with a common lifetime: the temporaries of compiling a statement,
+ * or compiled code that is kept as long as its Session.
+ *
+ * Destructors are not run, so only trivially destructible objects belong
+ * in an Arena. Arena_allocator lets a standard container take its memory
+ * from an Arena; Arena_vector is the common case.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "../lib/std_lib_facilities.h"
+#include <cstdint>
+#include <memory>
+
+class Arena {
+public:
+  explicit Arena(size_t block_size = 1 << 16) : block_size{block_size} {}
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void *allocate(size_t n, size_t align);
+  template <class T> T *allocate(size_t n) {
+    return static_cast<T *>(allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void reset(); // everything allocated is gone; the blocks are kept
+
+private:
+  struct Block {
+    unique_ptr<char[]> data;
+    size_t size;
+  };
+  size_t block_size;
+  vector<Block> blocks;
+  size_t current{0};   // blocks[current] is the one being used ...
+  char *next{nullptr}; // ... from here
+  char *stop{nullptr}; // ... to here
+};
+
+// p rounded up to a multiple of align (a power of two)
+inline char *align_up(char *p, size_t align) {
+  return reinterpret_cast<char *>(
+      (reinterpret_cast<uintptr_t>(p) + align - 1) & ~(align - 1));
+}
+
+inline void *Arena::allocate(size_t n, size_t align) {
+  if (next) {
+    char *p = align_up(next, align);
+    if (p + n <= stop) {
+      next = p + n;
+      return p;
+    }
+  }
+
+  // on to the next block: one of the unused ones that is big enough, or a
+  // new one, moved into place after the current one
+  const size_t need = n + align;
+  const size_t first = next ? current + 1 : 0;
+  size_t b = first;
+  while (b < blocks.size() && blocks[b].size < need)
+    ++b;
+  if (b == blocks.size()) {
+    const size_t size = max(block_size, need);
+    blocks.push_back(Block{make_unique<char[]>(size), size});
+  }
+  swap(blocks[first], blocks[b]);
+  current = first;
+  char *p = align_up(blocks[current].data.get(), align);
+  next = p + n;
+  stop = blocks[current].data.get() + blocks[current].size;
+  return p;
+}
+
+inline void Arena::reset() {
+  current = 0;
+  next = blocks.empty() ? nullptr : blocks[0].data.get();
+  stop = blocks.empty() ? nullptr : next + blocks[0].size;
+}
+
+template <class T> class Arena_allocator {
+public:
+  using value_type = T;
+
+  explicit Arena_allocator(Arena &a) : arena{&a} {}
+  template <class U>
+  Arena_allocator(const Arena_allocator<U> &a) : arena{a.arena} {}
+
+  T *allocate(size_t n) { return arena->allocate<T>(n); }
+  void deallocate(T *, size_t) {} // reset() takes care of it
+
+  Arena *arena;
+};
+
+template <class T, class U>
+bool operator==(const Arena_allocator<T> &a, const Arena_allocator<U> &b) {
+  return a.arena == b.arena;
+}
+template <class T, class U>
+bool operator!=(const Arena_allocator<T> &a, const Arena_allocator<U> &b) {
+  return a.arena != b.arena;
+}
+
+// a std::vector whose elements live in an Arena; not a range-checked
+// Vector, which takes no allocator, so the vector macro has to step aside
+#pragma push_macro("vector")
+#undef vector
+template <class T> using Arena_vector = std::vector<T, Arena_allocator<T>>;
+#pragma pop_macro("vector")
+
+#endif // ARENA_H
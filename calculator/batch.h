@@ -0,0 +1,468 @@
+/*
+ * batch.h
+ *
+ * Evaluating one compiled expression for many rows of variable values.
+ *
+ * A Batch binds some variables to columns of values. Evaluating a Code
+ * against it gives one result per row, as if the expression had been
+ * evaluated once per row with the variables set to that row's values.
+ * Variables that are not bound keep their single value from the
+ * Symbol_table.
+ *
+ * The rows are not run through the stack machine one at a time. The rows
+ * are taken batch_block at a time, and every stack slot holds a block of
+ * values rather than a single one, so each instruction becomes a short,
+ * simple loop over the block. The arithmetic is done by the kernels for
+ * the CPU we are running on (see kernels.h); a divide-by-zero check is one
+ * vector compare per few rows rather than a test per row.
+ *
+ * With more than one thread (set_threads()), the rows are cut into chunks
+ * of batch_chunk rows, a size that keeps a chunk's blocks in the cache, and
+ * the chunks are shared out between the threads, which steal from each
+ * other as they run out (see evaluate_parallel()). Each thread has stack
+ * blocks of its own and writes its chunks' rows of the result. The threads
+ * are started once, by the first evaluation that needs them, and kept for
+ * the ones after it (a Batch_pool). The results and errors are exactly
+ * those of one thread.
+ *
+ * And those are exactly the ones of evaluating the expression a row at a
+ * time: an expression that fails gives the error of the first row that
+ * fails, and of the first operator that fails in that row. The zero checks
+ * are done for a whole block, operator by operator, so a block that fails
+ * one is run again a row at a time to find that row (see fail_in_block()).
+ *
+ * A Basic_batch computes with numbers of type T (see number.h): the code's
+ * constants, the columns and the results are Ts, and so is all the
+ * arithmetic; a Batch is the Basic_batch of doubles. A Basic_batch<float>
+ * takes half the memory, and its kernels do twice as many rows per
+ * instruction.
+ */
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "../lib/std_lib_facilities.h"
+#include "code.h"
+#include "kernels.h"
+#include "symbol_table.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+constexpr int batch_block = 256; // rows per block; a few KB per stack slot
+constexpr int batch_chunk = 64 * batch_block; // rows a thread takes at once
+
+/**
+ * Threads that wait to be given work, so that evaluating many expressions
+ * over a batch starts its threads just once. run() is one evaluation's
+ * worth of work: work(0) on the calling thread, and work(w) on the pool's
+ * w-th thread, for w up to n; one run() at a time.
+ */
+class Batch_pool {
+public:
+  explicit Batch_pool(int nthreads); // besides the caller's
+  ~Batch_pool();
+
+  Batch_pool(const Batch_pool &) = delete;
+  Batch_pool &operator=(const Batch_pool &) = delete;
+
+  int size() const { return threads.size(); }
+  template <class F> void run(int n, F &work) { // n <= size() + 1
+    run(n, [](void *f, int w) { (*static_cast<F *>(f))(w); }, &work);
+  }
+
+private:
+  mutex running; // held for a run()
+  mutex m;       // for everything below
+  condition_variable wake;
+  condition_variable done;
+  void (*call)(void *, int){nullptr}; // the work: call(job, w)
+  void *job{nullptr};
+  int job_threads{0};
+  uint64_t jobs{0}; // run()s so far
+  int busy{0};      // threads still at this one
+  bool stopping{false};
+  vector<thread> threads;
+
+  void run(int n, void (*f)(void *, int), void *work);
+  void serve(int w);
+};
+
+inline Batch_pool::Batch_pool(int nthreads) {
+  for (int w = 1; w <= nthreads; ++w)
+    threads.emplace_back([this, w] { serve(w); });
+}
+
+inline Batch_pool::~Batch_pool() {
+  {
+    lock_guard<mutex> g{m};
+    stopping = true;
+  }
+  wake.notify_all();
+  for (thread &t : threads)
+    t.join();
+}
+
+inline void Batch_pool::serve(int w) {
+  uint64_t seen = 0;
+  unique_lock<mutex> l{m};
+  while (true) {
+    wake.wait(l, [&] { return stopping || jobs != seen; });
+    if (stopping)
+      return;
+    seen = jobs;
+    if (w < job_threads) {
+      void (*const f)(void *, int) = call;
+      void *const work = job;
+      l.unlock();
+      f(work, w);
+      l.lock();
+    }
+    if (--busy == 0)
+      done.notify_one();
+  }
+}
+
+inline void Batch_pool::run(int n, void (*f)(void *, int), void *work) {
+  lock_guard<mutex> r{running};
+  {
+    lock_guard<mutex> g{m};
+    call = f;
+    job = work;
+    job_threads = n;
+    busy = threads.size();
+    ++jobs;
+  }
+  wake.notify_all();
+  f(work, 0);
+  unique_lock<mutex> l{m};
+  done.wait(l, [&] { return busy == 0; });
+  call = nullptr;
+  job = nullptr;
+}
+
+template <class T> class Basic_batch {
+public:
+  void bind(int id, vector<T> values); // id's values, one per row
+  int rows() const { return nrows; }
+  bool is_bound(int id) const { return column_of(id) != nullptr; }
+
+  // evaluate on n threads (0: one per core); the results are the same
+  void set_threads(int n);
+
+  // evaluate c once per row into out[0..rows()); on more than one thread,
+  // one evaluation at a time
+  void evaluate(const Basic_code<T> &c, const Basic_symbol_table<T> &st,
+                T *out) const;
+
+private:
+  vector<int> ids;        // the bound variables ...
+  vector<vector<T>> cols; // ... and their columns
+  int nrows{0};
+  int nthreads{1};
+  mutable unique_ptr<Batch_pool> pool; // nthreads - 1 of them, once needed
+
+  const T *column_of(int id) const;
+  void evaluate_rows(const Basic_code<T> &c, const vector<const T *> &column,
+                     const vector<T> &scalar, int begin, int end,
+                     T *out) const;
+  void fail_in_block(const Basic_code<T> &c, const vector<const T *> &column,
+                     const vector<T> &scalar, int first, int n) const;
+  void evaluate_parallel(const Basic_code<T> &c,
+                         const vector<const T *> &column,
+                         const vector<T> &scalar, int nchunks, int nthreads,
+                         T *out) const;
+};
+
+using Batch = Basic_batch<double>;
+
+template <class T> void Basic_batch<T>::set_threads(int n) {
+  nthreads = n > 0 ? n : max(1u, thread::hardware_concurrency());
+  if (pool && pool->size() != nthreads - 1)
+    pool.reset();
+}
+
+template <class T> void Basic_batch<T>::bind(int id, vector<T> values) {
+  if (!ids.empty() && int(values.size()) != nrows)
+    error("batch: columns must all have the same number of rows");
+  nrows = values.size();
+  for (int i = 0; i < int(ids.size()); ++i)
+    if (ids[i] == id) {
+      cols[i] = move(values);
+      return;
+    }
+  ids.push_back(id);
+  cols.push_back(move(values));
+}
+
+template <class T> const T *Basic_batch<T>::column_of(int id) const {
+  for (int i = 0; i < int(ids.size()); ++i)
+    if (ids[i] == id)
+      return cols[i].data();
+  return nullptr;
+}
+
+template <class T>
+void Basic_batch<T>::evaluate(const Basic_code<T> &c,
+                              const Basic_symbol_table<T> &st, T *out) const {
+  // resolve every load once: a column, or a value that is the same for
+  // every row (looking it up here reports undefined variables up front)
+  vector<const T *> column(c.code.size(), nullptr);
+  vector<T> scalar(c.code.size(), T(0));
+  for (int i = 0; i < int(c.code.size()); ++i) {
+    const Instruction &in = c.code[i];
+    if (in.op == Op::define)
+      error("batch: declarations can't be evaluated over columns");
+    if (in.op == Op::assign)
+      error("batch: assignments can't be evaluated over columns");
+    if (in.op == Op::load && !(column[i] = column_of(in.arg)))
+      scalar[i] = st.get(in.arg);
+  }
+
+  const int nchunks = (nrows + batch_chunk - 1) / batch_chunk;
+  const int n = min(nthreads, nchunks);
+  if (n <= 1)
+    evaluate_rows(c, column, scalar, 0, nrows, out);
+  else
+    evaluate_parallel(c, column, scalar, nchunks, n, out);
+}
+
+// rows [begin, end) of the evaluation, block by block; throws at the first
+// row that fails, as the whole evaluation would
+template <class T>
+void Basic_batch<T>::evaluate_rows(const Basic_code<T> &c,
+                                   const vector<const T *> &column,
+                                   const vector<T> &scalar, int begin,
+                                   int end, T *out) const {
+  // each stack slot has a block of its own to compute into; a slot's
+  // values are either there or in a column (for a plain load)
+  const int depth = max(c.max_depth, 1);
+  vector<T> blocks(depth * batch_block);
+  vector<const T *> stack(depth);
+  const Instruction *code = c.code.data();
+  const int ncode = c.code.size();
+  const Kernels_for<T> &k = kernels<T>();
+
+  for (int first = begin; first < end; first += batch_block) {
+    const int n = min(batch_block, end - first);
+    int sp = 0; // stack[sp-1] is the top
+    for (int i = 0; i < ncode; ++i) {
+      const Op op = code[i].op;
+      if (op == Op::load && column[i]) {
+        stack[sp++] = column[i] + first;
+        continue;
+      }
+      if (op == Op::number || op == Op::load) {
+        const T d = op == Op::number ? c.constants[code[i].arg] : scalar[i];
+        T *dst = blocks.data() + sp * batch_block;
+        for (int j = 0; j < n; ++j)
+          dst[j] = d;
+        stack[sp++] = dst;
+        continue;
+      }
+      if (op == Op::negate) {
+        const T *a = stack[sp - 1];
+        T *dst = blocks.data() + (sp - 1) * batch_block;
+        for (int j = 0; j < n; ++j)
+          dst[j] = -a[j];
+        stack[sp - 1] = dst;
+        continue;
+      }
+
+      // a binary operator: next op top
+      --sp;
+      const T *a = stack[sp - 1];
+      const T *b = stack[sp];
+      T *dst = blocks.data() + (sp - 1) * batch_block;
+      switch (op) {
+      case Op::add:
+        k.add(dst, a, b, n);
+        break;
+      case Op::sub:
+        k.sub(dst, a, b, n);
+        break;
+      case Op::mul:
+        k.mul(dst, a, b, n);
+        break;
+      case Op::div:
+        if (k.any_zero(b, n))
+          fail_in_block(c, column, scalar, first, n);
+        k.div(dst, a, b, n);
+        break;
+      case Op::mod:
+        if (k.any_zero(b, n))
+          fail_in_block(c, column, scalar, first, n);
+        k.mod(dst, a, b, n);
+        break;
+      default:
+        error("batch: bad instruction");
+      }
+      stack[sp - 1] = dst;
+    }
+    copy(stack[0], stack[0] + n, out + first);
+  }
+}
+
+// the block of n rows from first has a zero divisor somewhere: run its rows
+// one at a time, as try_evaluate() would, and throw the error of the first
+// one to fail
+template <class T>
+void Basic_batch<T>::fail_in_block(const Basic_code<T> &c,
+                                   const vector<const T *> &column,
+                                   const vector<T> &scalar, int first,
+                                   int n) const {
+  vector<T> stack(max(c.max_depth, 1));
+  for (int row = first; row < first + n; ++row) {
+    int sp = 0;
+    for (int i = 0; i < int(c.code.size()); ++i) {
+      const Instruction &in = c.code[i];
+      switch (in.op) {
+      case Op::number:
+        stack[sp++] = c.constants[in.arg];
+        break;
+      case Op::load:
+        stack[sp++] = column[i] ? column[i][row] : scalar[i];
+        break;
+      case Op::negate:
+        stack[sp - 1] = -stack[sp - 1];
+        break;
+      case Op::add:
+        --sp;
+        stack[sp - 1] += stack[sp];
+        break;
+      case Op::sub:
+        --sp;
+        stack[sp - 1] -= stack[sp];
+        break;
+      case Op::mul:
+        --sp;
+        stack[sp - 1] *= stack[sp];
+        break;
+      case Op::div:
+        --sp;
+        if (stack[sp] == T(0))
+          error("divide by zero");
+        stack[sp - 1] /= stack[sp];
+        break;
+      case Op::mod:
+        --sp;
+        if (stack[sp] == T(0))
+          error("%:divide by zero");
+        stack[sp - 1] = fmod(stack[sp - 1], stack[sp]);
+        break;
+      default:
+        error("batch: bad instruction");
+      }
+    }
+  }
+  error("batch: a zero divisor no row has"); // can't happen
+}
+
+// the chunks spread over nthreads workers, each with a range of chunks of
+// its own, taken from the front; a worker that runs out steals the back
+// half of another's range. The first chunk (in row order) to fail decides
+// the error, so it is the one a single thread would have given.
+template <class T>
+void Basic_batch<T>::evaluate_parallel(const Basic_code<T> &c,
+                                       const vector<const T *> &column,
+                                       const vector<T> &scalar, int nchunks,
+                                       int nthreads, T *out) const {
+  struct alignas(64) Worker {
+    mutex m;
+    int next; // chunks [next, last) are still to do
+    int last;
+  };
+  vector<unique_ptr<Worker>> workers;
+  for (int w = 0; w < nthreads; ++w) {
+    workers.push_back(make_unique<Worker>());
+    workers[w]->next = long(nchunks) * w / nthreads;
+    workers[w]->last = long(nchunks) * (w + 1) / nthreads;
+  }
+
+  atomic<int> failed{nchunks}; // the first chunk that failed so far
+  mutex failure_lock;
+  string failure; // ... and its message
+
+  // the next chunk for worker w, its own or stolen; -1 when all are done
+  auto take = [&](int w) {
+    {
+      Worker &me = *workers[w];
+      lock_guard<mutex> g{me.m};
+      if (me.next < me.last)
+        return me.next++;
+    }
+    for (int k = 1; k < nthreads; ++k) {
+      Worker &victim = *workers[(w + k) % nthreads];
+      int first, last;
+      {
+        lock_guard<mutex> g{victim.m};
+        const int left = victim.last - victim.next;
+        if (left <= 0)
+          continue;
+        last = victim.last;
+        first = victim.last -= (left + 1) / 2;
+      }
+      Worker &me = *workers[w];
+      lock_guard<mutex> g{me.m};
+      me.next = first + 1;
+      me.last = last;
+      return first;
+    }
+    return -1;
+  };
+
+  auto work = [&](int w) {
+    for (int i; (i = take(w)) >= 0;) {
+      if (i > failed) // a result no one will see
+        continue;
+      const int begin = i * batch_chunk;
+      const int end = min(nrows, begin + batch_chunk);
+      try {
+        evaluate_rows(c, column, scalar, begin, end, out);
+      } catch (exception &e) {
+        lock_guard<mutex> g{failure_lock};
+        if (i < failed) {
+          failed = i;
+          failure = e.what();
+        }
+      }
+    }
+  };
+  if (!pool)
+    pool = make_unique<Batch_pool>(this->nthreads - 1);
+  pool->run(nthreads, work);
+  if (failed < nchunks)
+    error(failure);
+}
+
+// read a table of columns: a line of variable names, then one line of
+// numbers per row; bind each name's column in b (the numbers are read as
+// doubles, then rounded to T)
+template <class T>
+void read_columns(istream &is, Symbol_names &st, Basic_batch<T> &b) {
+  string header;
+  getline(is, header);
+  istringstream names{header};
+  vector<int> ids;
+  for (string s; names >> s;)
+    ids.push_back(st.intern(s));
+  if (ids.empty())
+    error("batch: no column names");
+
+  vector<vector<T>> cols(ids.size());
+  for (double d; is >> d;) {
+    cols[0].push_back(T(d));
+    for (int i = 1; i < int(ids.size()); ++i) {
+      if (!(is >> d))
+        error("batch: short row ", int(cols[0].size()));
+      cols[i].push_back(T(d));
+    }
+  }
+  if (!is.eof())
+    error("batch: bad number in row ", int(cols[0].size()) + 1);
+  for (int i = 0; i < int(ids.size()); ++i)
+    b.bind(ids[i], move(cols[i]));
+}
+
+#endif // BATCH_H
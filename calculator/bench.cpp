@@ -0,0 +1,254 @@
+/*
+ * Calculator benchmark
+ *
+ * Generates a random script (see workload.h) and times the ways the
+ * calculator can run it:
+ *   interactive  read, compile and run each statement, as calculate() does
+ *   compiled     run statements that were compiled beforehand
+ *   native       the same, compiled on to machine code (see jit.h)
+ *   memo         the same, interpreted, keeping subexpressions' values
+ *                (see memo.h)
+ *   batch        run expressions over columns of rows (see batch.h)
+ *   parallel     the same, on threads threads (default: one per core)
+ *   float        batch, computing in float (see number.h)
+ *   compensated  batch, computing in double-double
+ * For each it reports throughput and the median and 99th percentile time
+ * per statement (for batch: per expression over all the rows).
+ *
+ * Build it like the calculator, with optimization:
+ *         g++ -std=c++17 -O2 -pthread bench.cpp -o bench
+ * usage: bench [-n statements] [-r rows] [-s seed] [-j threads]
+ */
+#include "../lib/std_lib_facilities.h"
+#include "batch.h"
+#include "jit.h"
+#include "memo.h"
+#include "parser.h"
+#include "session.h"
+#include "workload.h"
+#include <chrono>
+
+using Clock = chrono::steady_clock;
+
+double seconds(Clock::duration d) {
+  return chrono::duration<double>(d).count();
+}
+
+// the times taken by the statements of one run
+struct Timings {
+  vector<double> each; // seconds per statement
+  double total{0};
+  long tokens{0};
+  long statements{0};
+  long failed{0};
+  double value_sum{0}; // so that the work can't be optimized away
+
+  void add(Clock::duration d) {
+    each.push_back(seconds(d));
+    total += each.back();
+  }
+  double percentile(double p) {
+    if (each.empty())
+      return 0;
+    sort(each);
+    return each[min(each.size() - 1, size_t(p * each.size()))];
+  }
+};
+
+// the script's tokens (all at once, see tokenize()), and how long that took
+long count_tokens(const string &script, double &seconds_taken) {
+  Symbol_table st;
+  vector<Token> tokens;
+  vector<long> where;
+  Clock::time_point start = Clock::now();
+  tokenize(script, st, tokens, where);
+  seconds_taken = seconds(Clock::now() - start);
+  return tokens.size() - 1; // not the quit
+}
+
+// read, compile and run each statement, as calculate() does
+Timings run_interactive(const string &script) {
+  Timings t;
+  istringstream is{script};
+  Session s{is, Token_stream::Mode::block};
+  Code c;
+  while (true) {
+    while (s.ts.peek().kind == print)
+      s.ts.get();
+    if (s.ts.peek().kind == quit)
+      break;
+    Clock::time_point start = Clock::now();
+    Expected<double> r = try_statement(s, c);
+    t.add(Clock::now() - start);
+    ++t.statements;
+    if (r)
+      t.value_sum += *r;
+    else {
+      ++t.failed;
+      s.ts.ignore(print);
+    }
+  }
+  return t;
+}
+
+// how run_compiled() runs the code
+enum class Runner { interpreter, native, memo };
+
+// compile the script's expressions once, then run them repeats times each;
+// the declarations are run (once) beforehand, so the variables are there
+Timings run_compiled(const string &script, int repeats, Runner how) {
+  Timings t;
+  istringstream is{script};
+  Session s{is, Token_stream::Mode::block};
+  vector<Code> codes;
+  Code c;
+  while (true) {
+    while (s.ts.peek().kind == print)
+      s.ts.get();
+    if (s.ts.peek().kind == quit)
+      break;
+    if (!try_compile_statement(s, c).ok()) {
+      s.ts.ignore(print);
+      continue;
+    }
+    if (c.code.back().op == Op::define)
+      try_evaluate(c, s.names);
+    else
+      codes.push_back(c);
+  }
+
+  Jit_memory jit;
+  vector<Native_code> natives(codes.size());
+  if (how == Runner::native)
+    for (size_t i = 0; i < codes.size(); ++i)
+      natives[i].compile(codes[i].view(), s.names, jit);
+  Memo_cache memo;
+
+  for (int k = 0; k < repeats; ++k)
+    for (size_t i = 0; i < codes.size(); ++i) {
+      Clock::time_point start = Clock::now();
+      Expected<double> r =
+          how == Runner::native ? natives[i].run(codes[i].view(), s.names)
+          : how == Runner::memo ? memo.evaluate(codes[i].view(), s.names)
+                                : try_evaluate(codes[i], s.names);
+      t.add(Clock::now() - start);
+      ++t.statements;
+      if (r)
+        t.value_sum += *r;
+      else
+        ++t.failed;
+    }
+  return t;
+}
+
+// run random expressions in a, b, c and d over rows rows, on threads
+// threads, computing in T
+template <class T>
+Timings run_batch(int expressions, int rows, int seed, int threads) {
+  Workload w{seed, {"a", "b", "c", "d"}};
+  string text;
+  for (int i = 0; i < expressions; ++i)
+    text += w.expression() + ";\n";
+
+  Timings t;
+  istringstream is{text};
+  Basic_session<T> s{is, Token_stream::Mode::block};
+  Basic_batch<T> b;
+  b.set_threads(threads);
+  vector<int> r(rows);
+  for (const string name : {"a", "b", "c", "d"}) {
+    randint(r.begin(), r.end(), 1, 1000);
+    vector<T> col(rows);
+    for (int i = 0; i < rows; ++i)
+      col[i] = T(r[i] / 8.0);
+    b.bind(s.names.intern(name), move(col));
+  }
+
+  vector<T> out(rows);
+  Basic_code<T> c;
+  while (true) {
+    while (s.ts.peek().kind == print)
+      s.ts.get();
+    if (s.ts.peek().kind == quit)
+      break;
+    if (!try_compile_statement(s, c).ok()) {
+      s.ts.ignore(print);
+      continue;
+    }
+    Clock::time_point start = Clock::now();
+    try {
+      b.evaluate(c, s.names, out.data());
+      t.value_sum += double(out[0]);
+    } catch (exception &) {
+      ++t.failed;
+    }
+    t.add(Clock::now() - start);
+    t.statements += rows;
+  }
+  return t;
+}
+
+void report(const string &path, Timings t, const string &unit) {
+  cout << left << setw(12) << path << right << setw(14) << fixed
+       << setprecision(0) << t.statements / t.total << ' ' << setw(10)
+       << unit;
+  if (t.tokens)
+    cout << setw(14) << t.tokens / t.total << " tokens/s";
+  else
+    cout << setw(23) << "";
+  cout << setprecision(2) << "  p50 " << setw(9) << t.percentile(0.50) * 1e6
+       << " us  p99 " << setw(9) << t.percentile(0.99) * 1e6 << " us";
+  if (t.failed)
+    cout << "  (" << t.failed << " failed)";
+  cout << '\n';
+}
+
+int main(int argc, char *argv[]) {
+  try {
+    int statements = 100000;
+    int rows = 1000000;
+    int seed = 1;
+    int threads = 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+      string arg = argv[i];
+      if (arg == "-n")
+        statements = stoi(argv[i + 1]);
+      else if (arg == "-r")
+        rows = stoi(argv[i + 1]);
+      else if (arg == "-s")
+        seed = stoi(argv[i + 1]);
+      else if (arg == "-j")
+        threads = stoi(argv[i + 1]);
+      else
+        error("unknown option ", arg);
+    }
+
+    Workload w{seed};
+    const string script = w.script(statements);
+    double lexing;
+    const long tokens = count_tokens(script, lexing);
+    cout << statements << " statements, " << tokens << " tokens, "
+         << script.size() << " bytes; " << kernels().name << " kernels\n"
+         << "tokenized at " << fixed << setprecision(0) << tokens / lexing
+         << " tokens/s, " << script.size() / lexing / 1e6 << " MB/s\n";
+
+    Timings t = run_interactive(script);
+    t.tokens = tokens;
+    report("interactive", t, "stmts/s");
+
+    report("compiled", run_compiled(script, 10, Runner::interpreter),
+           "stmts/s");
+    report("native", run_compiled(script, 10, Runner::native), "stmts/s");
+    report("memo", run_compiled(script, 10, Runner::memo), "stmts/s");
+
+    report("batch", run_batch<double>(20, rows, seed, 1), "rows/s");
+    report("parallel", run_batch<double>(20, rows, seed, threads), "rows/s");
+    report("float", run_batch<float>(20, rows, seed, 1), "rows/s");
+    report("compensated", run_batch<Compensated>(20, rows, seed, 1),
+           "rows/s");
+    return 0;
+  } catch (exception &e) {
+    cerr << e.what() << '\n';
+    return 1;
+  }
+}
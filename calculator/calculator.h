@@ -0,0 +1,197 @@
+/*
+ * calculator.h
+ *
+ * The calculator's statement loops: read statements from a Session and
+ * write their results, until the input says quit (or runs out).
+ */
+#ifndef CALCULATOR_H
+#define CALCULATOR_H
+
+#include "../lib/std_lib_facilities.h"
+#include "batch.h"
+#include "output.h"
+#include "parser.h"
+#include "script_cache.h"
+#include "session.h"
+
+const string prompt = "> ";
+const string result = "= ";
+
+template <class T> void clean_up_mess(Basic_session<T> &s) {
+  s.ts.ignore(print);
+}
+
+// write stale_report(s), if there is anything in it, to err, after what out
+// has written
+template <class T>
+void report_stale(const Basic_session<T> &s, Output &out, ostream &err) {
+  const string stale = stale_report(s);
+  if (stale.empty())
+    return;
+  out.flush(); // keep it in its place if os and err are shared
+  err << stale;
+}
+
+// add what was compiled (c, or the error e) to rec; a script cache holds
+// code of doubles only, so a recording of any other numbers is spoiled
+template <class T>
+void record(Script_recording &rec, const Basic_code<T> &c,
+            const Calc_error &e, bool starts_bad) {
+  if constexpr (is_same_v<T, double>) {
+    if (e.ok())
+      rec.add(c);
+    else
+      rec.add(e, starts_bad);
+  } else {
+    rec.spoil();
+  }
+}
+
+// expression evaluation loop
+// a statement that fails is reported without an exception being thrown;
+// see status.h
+// if rec isn't null, what is compiled is recorded there (see script_cache.h)
+template <class T>
+void calculate(Basic_session<T> &s, ostream &os = cout, ostream &err = cerr,
+               Script_recording *rec = nullptr) {
+  Basic_code<T> c;
+  while (true) // until ts gives us a quit Token
+    try {
+      {
+        os << prompt;
+        while (s.ts.peek().kind == print)
+          s.ts.get(); // eat ';'
+        if (s.ts.peek().kind == quit) {
+          return;
+        }
+        const bool starts_bad = s.ts.peek().kind == bad;
+        if (!starts_bad) // that is reported before the "= "
+          os << result;
+        Calc_error e = try_compile_statement(s, c);
+        if (rec)
+          record(*rec, c, e, starts_bad);
+        Expected<T> r = e.ok() ? try_run(s, c.view()) : e;
+        if (r) {
+          os << *r << '\n';
+          err << stale_report(s);
+        } else {
+          err << message(r.error(), s.names) << '\n';
+          clean_up_mess(s);
+        }
+      }
+    } catch (exception &e) {
+      if (rec)
+        rec->spoil();
+      err << e.what() << '\n';
+      clean_up_mess(s);
+    }
+}
+
+// run a script calculate() (or calculate_unprompted()) has run, and
+// recorded, before, from the code it compiled, in a fresh Session; writes
+// what calculate() wrote, or without prompts what calculate_unprompted()
+// wrote
+inline void replay(const Cached_script &cs, Session &s, ostream &os = cout,
+                   ostream &err = cerr, bool prompts = true) {
+  Output out{os};
+  for (int i = 0; i < cs.size(); ++i) {
+    const cache_format::Statement &st = cs.statement(i);
+    if (prompts) {
+      out.put(prompt);
+      if (!st.starts_bad)
+        out.put(result);
+    }
+    Expected<double> r = st.size ? try_run(s, cs.code(i))
+                                 : Calc_error{st.error, st.pos, st.error_id};
+    if (r) {
+      if (!prompts)
+        out.put(result);
+      out.put(*r);
+      out.put('\n');
+      report_stale(s, out, err);
+    } else {
+      out.flush(); // keep the error in its place if os and err are shared
+      err << message(r.error(), s.names) << '\n';
+    }
+  }
+  if (prompts)
+    out.put(prompt); // the one that was answered by quit
+}
+
+// expression evaluation loop for input that doesn't come from a person:
+// no prompts, and each result that is computed is written as the same
+// "= value" line calculate() writes, but through an Output (see output.h);
+// errors are reported as calculate() reports them
+// if rec isn't null, what is compiled is recorded there, as calculate()
+// records it
+template <class T>
+void calculate_unprompted(Basic_session<T> &s, ostream &os = cout,
+                          ostream &err = cerr,
+                          Script_recording *rec = nullptr) {
+  Output out{os};
+  Basic_code<T> c;
+  while (true)
+    try {
+      while (s.ts.peek().kind == print)
+        s.ts.get(); // eat ';'
+      if (s.ts.peek().kind == quit)
+        return;
+      const bool starts_bad = s.ts.peek().kind == bad;
+      Calc_error e = try_compile_statement(s, c);
+      if (rec)
+        record(*rec, c, e, starts_bad);
+      Expected<T> r = e.ok() ? try_run(s, c.view()) : e;
+      if (r) {
+        out.put(result);
+        out.put(*r);
+        out.put('\n');
+        report_stale(s, out, err);
+      } else {
+        out.flush(); // keep the error in its place if os and err are shared
+        err << message(r.error(), s.names) << '\n';
+        clean_up_mess(s);
+      }
+    } catch (exception &e) {
+      if (rec)
+        rec->spoil();
+      out.flush();
+      err << e.what() << '\n';
+      clean_up_mess(s);
+    }
+}
+
+// batch evaluation loop: each expression is evaluated once for every row of
+// b and its results written one per line; declarations (and assignments)
+// are run just once
+template <class T>
+void calculate_batch(Basic_session<T> &s, const Basic_batch<T> &b,
+                     ostream &os = cout, ostream &err = cerr) {
+  Output o{os};
+  Basic_code<T> c;
+  vector<T> out(b.rows());
+  while (true)
+    try {
+      while (s.ts.peek().kind == print)
+        s.ts.get(); // eat ';'
+      if (s.ts.peek().kind == quit)
+        return;
+      compile_statement(s, c);
+      if (c.code.back().op == Op::define || c.code.back().op == Op::assign) {
+        Expected<T> r = try_evaluate(c, s.names);
+        if (!r)
+          error(message(r.error(), s.names));
+        continue;
+      }
+      b.evaluate(c, s.names, out.data());
+      for (const T &d : out) {
+        o.put(d);
+        o.put('\n');
+      }
+    } catch (exception &e) {
+      o.flush();
+      err << e.what() << '\n';
+      clean_up_mess(s);
+    }
+}
+
+#endif // CALCULATOR_H
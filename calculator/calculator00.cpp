@@ -17,9 +17,12 @@
  *         q
  * Statement:
  *         Declaration
+ *         Assignment
  *         Expression
  * Declaration:
  *         "let" Name "=" Expression
+ * Assignment:
+ *         Name "=" Expression
  * Name:
  *         character
  *         Name + character
@@ -44,331 +47,168 @@
  * Varable:
  *         { Name, Number } pair
  *
- * Input comes from cin through the Token_stream called ts.
+ * Input comes from cin (or from files) through the Token_stream of a
+ * Session; see session.h.
  */
 #include "../lib/std_lib_facilities.h"
-
-const char number = '8'; // t.kind == number means that t is a number Token
-const char quit = 'q';   // t.kind == quit means that t is a quit Token
-const char print = ';';  // t.kind == print means that t is a print Token
-const string prompt = "> ";
-const string result = "= ";
-const char name = 'a';        // name token
-const char let = 'L';         // declaration token
-const string declkey = "let"; // declaration key
-
-/**
- * A conventional way of reading stuff from input and store it
- * in a way that lets us look at it in convenient ways. 'tokenize'
- */
-class Token {
-public:
-  char kind;
-  double value;
-  string name;
-  Token(char k) : kind{k}, value{0.0} {}
-  Token(char k, double v) : kind{k}, value{v} {}
-  Token(double v) : kind{number}, value{v} {}
-  Token(char ch, string n) : kind{ch}, name{n} {}
-};
-
-/**
- * Grammar
- * Reading a stream of tokens according to a grammar is called parsing,
- * and a program that does that is often called a parser or a syntax analyzer.
- *
- * // a simple expression grammar:
- * Expression:
- *      Term
- *      Expression + Term    // addition
- *      Expression - Term    // subtraction
- * Term:
- *      Primary
- *      Term * Primary       // multiplication
- *      Term / Primary       // division
- *      Term % Primary       // remainder (modulo)
- * Primary:
- *      Number
- *      ( Expression )       // grouping
- *      + Primary
- *      - Primary
- * Number:
- *      floating-point-literal
- */
-
-/**
- * A stream that produces a token when we ask for one using get() and where we
- * can put a token back into the stream using putback().
- */
-class Token_stream {
-public:
-  Token get();           // get a token
-  void putback(Token t); // put a token back
-  void ignore(char c);   // discard characters up to and including a c
-private:
-  bool full{false}; // is there a token in the buffer
-  Token buffer{0.0};
-};
-
-void Token_stream::putback(Token t) {
-  if (full)
-    error("putback() into a full buffer");
-  buffer = t;
-  full = true;
+#include "batch.h"
+#include "calculator.h"
+#include "driver.h"
+#include "mapped_file.h"
+#include "pipeline.h"
+#include "server.h"
+#include "session.h"
+#include "stats.h"
+
+// evaluate s's expressions over the columns of the table in file
+template <class T>
+void calculate_columns(Basic_session<T> &s, const string &file, int threads) {
+  ifstream is{file};
+  if (!is)
+    error("can't open ", file);
+  Basic_batch<T> b;
+  b.set_threads(threads);
+  read_columns(is, s.names, b);
+  calculate_batch(s, b);
 }
 
-// read characters from cin and compose a Token
-Token Token_stream::get() {
-  // check if we already have a Token ready
-  if (full) {
-    full = false;
-    return buffer;
-  }
-  char ch;
-  cin >> ch; // note that >> skips whitespace (space, newline, tab, etc.)
-  switch (ch) {
-  case print: // for "print"
-  case quit:  // for "quit"
-  case '=':   // for declaration and assignment
-  case '(':
-  case ')':
-  case '+':
-  case '-':
-  case '*':
-  case '/':
-  case '%':
-    return Token{ch}; // let each character represent itself
-  case '.':           // a floating-point-literal can start with a dot
-  case '0':
-  case '1':
-  case '2':
-  case '3':
-  case '4':
-  case '5':
-  case '6':
-  case '7':
-  case '8':
-  case '9': {
-    cin.putback(ch);
-    double val;
-    cin >> val;
-    return Token{val};
-  }
-  default:
-    if (isalpha(ch)) {
-      string s;
-      s += ch;
-      while (cin.get(ch) && (isalpha(ch) || isdigit(ch)))
-        s += ch;
-      cin.putback(ch);
-      if (s == declkey)
-        return Token{let}; // decalration keyword
-      return Token{name, s};
-    }
-    error("Bad token");
-  }
-}
-
-void Token_stream::ignore(char c) {
-  // first look in buffer:
-  if (full && c == buffer.kind) {
-    full = false;
-    return;
-  }
-  full = false;
-  // now search for input:
-  char ch = 0;
-  while (cin >> ch) {
-    if (ch == c)
-      return;
-  }
-}
-
-Token_stream ts; // provides get() and putback()
-
-class Variable {
-public:
-  string name;
-  double value;
+// what main()'s options ask for
+struct Options {
+  Token_stream::Mode mode{Token_stream::Mode::line}; // for cin
+  Run_options run; // for every session: cin's, a file's, a connection's
+  string batch_file;
+  vector<string> files;
+  int threads{0};
+  string cache;
+  bool counts{false};
+  string address;
+  string mapped;
+  bool pipelined{false};
 };
 
-vector<Variable> var_table;
-
-// return the value of the variable named s
-double get_value(string s) {
-  for (const Variable &v : var_table)
-    if (v.name == s)
-      return v.value;
-  error("get: undefined variable ", s);
-}
-
-// set the Variable named s to d
-void set_value(string s, double d) {
-  for (Variable &v : var_table) {
-    if (v.name == s) {
-      v.value = d;
-      return;
+// do what o asks for, in sessions of Ts
+template <class T> void calculate_as(const Options &o) {
+  if (!o.address.empty()) {
+    serve<T>(o.address, o.run);
+  } else if (!o.mapped.empty()) {
+    Mapped_file f{o.mapped, Mapped_file::Access::sequential};
+    if (!f.is_open())
+      error("can't open ", o.mapped);
+    Basic_session<T> ms{string_view{f.data(), f.size()}};
+    o.run.apply(ms);
+    if (o.run.prompts)
+      calculate(ms);
+    else
+      calculate_unprompted(ms);
+    if (o.counts && ms.memoize)
+      ms.memo.report(cerr);
+  } else if (!o.files.empty()) {
+    calculate_files<T>(o.files, o.threads, o.cache, o.run);
+  } else {
+    Basic_session<T> s{cin, o.mode};
+    o.run.apply(s);
+    if (!o.batch_file.empty()) {
+      calculate_columns(s, o.batch_file, o.threads);
+    } else if (o.pipelined) {
+      calculate_pipelined(s);
+    } else if (!o.run.prompts) {
+      calculate_unprompted(s);
+    } else {
+      calculate(s);
+      keep_window_open();
     }
-    error("set: undefined variable ", s);
-  }
-}
-
-// is var declared in var_table
-bool is_declared(string var) {
-  for (const Variable &v : var_table) {
-    if (v.name == var)
-      return true;
-  }
-  return false;
-}
-
-// add { var, val } to var_table
-double define_name(string var, double val) {
-  if (is_declared(var))
-    error(var, " declared twice");
-  var_table.push_back(Variable{var, val});
-  return val;
-}
-
-double expression(); // declaration so that primary() can call expression()
-
-// assume we have seen "let"
-// handle: name = expression
-// declare a variable called "name" with the initial value "expression"
-double declaration() {
-  Token t = ts.get();
-  if (t.kind != name)
-    error("name expected in declaration");
-  string var_name = t.name;
-  Token t2 = ts.get();
-  if (t2.kind != '=')
-    error("= missing in declartion of ", var_name);
-  double d = expression();
-  define_name(var_name, d);
-  return d;
-}
-
-double statement() {
-  Token t = ts.get();
-  switch (t.kind) {
-  case let:
-    return declaration();
-  default:
-    ts.putback(t);
-    return expression();
+    if (o.counts && s.memoize)
+      s.memo.report(cerr);
   }
 }
 
-// deal with numbers and parentheses
-double primary() {
-  Token t = ts.get();
-  switch (t.kind) {
-  case '(': // handle ( expression )
-  {
-    double d = expression();
-    t = ts.get();
-    if (t.kind != ')')
-      error("')' expected");
-    return d;
-  }
-  case '8':
-    return t.value;
-  case '-':
-    return -primary();
-  case '+':
-    return primary();
-  default:
-    if (t.kind == name) {
-      return get_value(t.name);
+// main loop and deal with errors
+// usage: calculator00 [--block] [--no-prompt] [--reactive] [--batch file]
+//                     [-j n] [--cache dir] [--stats] [--serve address]
+//                     [--mmap file] [--pipeline] [--memo]
+//                     [--precision p] [file...]
+//   --block       read input in large blocks rather than a line at a time;
+//                 for input from a file or a pipe
+//   --no-prompt   write just the "= value" lines, without prompts, and
+//                 buffered; for output to a file or a pipe
+//   --reactive    declared variables keep their expressions and are
+//                 recomputed when a variable they use is assigned to
+//   --batch file  evaluate each expression for every row of the table in
+//                 file (a line of variable names, then rows of numbers)
+//   -j n          calculate the files, or the batch's rows, on n threads
+//                 (default: one per core)
+//   --cache dir   keep the files' compiled forms in dir, and replay a file
+//                 from there when it has been calculated before
+//   --stats       write what was counted (see stats.h) to cerr at the end
+//   --serve address
+//                 run as a server: statements come in on a socket (a Unix
+//                 socket path, or [host:]port for TCP), a session per
+//                 connection; see server.h
+//   --mmap file   read the statements from file, mapped into memory rather
+//                 than read through cin; for very large scripts
+//   --pipeline    lex, parse and run on three threads at once; as
+//                 --no-prompt, for input that is all there already
+//   --memo        keep the values of subexpressions, and use them again
+//                 until a variable they read changes (see memo.h)
+//   --precision p compute in float, double (the default), long (double)
+//                 or compensated (double-double) arithmetic; see number.h
+//   file...       calculate each file in a session of its own rather than
+//                 reading cin; the results come out in file order
+int main(int argc, char *argv[]) {
+  try {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+      string arg = argv[i];
+      if (arg == "--block")
+        o.mode = Token_stream::Mode::block;
+      else if (arg == "--no-prompt")
+        o.run.prompts = false;
+      else if (arg == "--reactive")
+        o.run.reactive = true;
+      else if (arg == "--batch" && i + 1 < argc)
+        o.batch_file = argv[++i];
+      else if (arg == "-j" && i + 1 < argc)
+        o.threads = stoi(argv[++i]);
+      else if (arg == "--cache" && i + 1 < argc)
+        o.cache = argv[++i];
+      else if (arg == "--stats")
+        o.counts = true;
+      else if (arg == "--serve" && i + 1 < argc)
+        o.address = argv[++i];
+      else if (arg == "--mmap" && i + 1 < argc)
+        o.mapped = argv[++i];
+      else if (arg == "--pipeline")
+        o.pipelined = true;
+      else if (arg == "--memo")
+        o.run.memoize = true;
+      else if (arg == "--precision" && i + 1 < argc)
+        o.run.precision = precision_named(argv[++i]);
+      else if (!arg.empty() && arg[0] != '-')
+        o.files.push_back(arg);
+      else
+        error("unknown option ", arg);
     }
-    error("primary expected");
-  }
-}
-
-// deal with * and /
-double term() {
-  double left = primary();
-  Token t = ts.get();
-  while (true) {
-    switch (t.kind) {
-    case '*':
-      left *= primary();
-      t = ts.get();
+    if (!o.cache.empty() && o.run.precision != Precision::float64)
+      error("--cache keeps code compiled for double precision only");
+    if (!o.cache.empty() &&
+        (o.files.empty() || !o.mapped.empty() || !o.address.empty()))
+      error("--cache keeps code for the files named on the command line only");
+    switch (o.run.precision) { // the one place the choice is made
+    case Precision::float32:
+      calculate_as<float>(o);
       break;
-    case '/': {
-      double d = primary();
-      if (d == 0)
-        error("divide by zero");
-      left /= d;
-      t = ts.get();
+    case Precision::float64:
+      calculate_as<double>(o);
       break;
-    }
-    case '%': {
-      double d = primary();
-      if (d == 0)
-        error("%:divide by zero");
-      left = fmod(left, d);
-      t = ts.get();
+    case Precision::extended:
+      calculate_as<long double>(o);
       break;
-    }
-    default:
-      ts.putback(t); // put t back into the token stream
-      return left;
-    }
-  }
-}
-
-// deal with + and -
-double expression() {
-  double left = term();
-  Token t = ts.get();
-  while (true) {
-    switch (t.kind) {
-    case '+':
-      left += term();
-      t = ts.get();
-      break;
-    case '-':
-      left -= term();
-      t = ts.get();
+    case Precision::compensated:
+      calculate_as<Compensated>(o);
       break;
-    default:
-      ts.putback(t); // put back into the token stream
-      return left;
     }
-  }
-}
-
-void clean_up_mess() { ts.ignore(print); }
-
-// expression evaluation loop
-void calculate() {
-  while (cin)
-    try {
-      {
-        cout << prompt;
-        Token t = ts.get();
-        while (t.kind == print)
-          t = ts.get(); // eat ';'
-        if (t.kind == quit) {
-          return;
-        }
-        ts.putback(t);
-        cout << result << statement() << '\n';
-      }
-    } catch (exception &e) {
-      cerr << e.what() << '\n';
-      clean_up_mess();
-    }
-}
-
-// main loop and deal with errors
-int main() {
-  try {
-    define_name("pi", 3.1415926535);
-    define_name("e", 2.7182818284);
-    calculate();
-    keep_window_open();
+    if (o.counts)
+      report_stats(cerr);
     return 0;
   } catch (exception &e) {
     cerr << e.what() << '\n';
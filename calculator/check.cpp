@@ -0,0 +1,1536 @@
+/*
+ * Calculator checks
+ *
+ * The interpreter, try_evaluate(), says what every statement means; the
+ * faster ways of running code have to give exactly what it gives, with
+ * the same bits (NaNs included: their signs and payloads) and the same
+ * errors. This program runs them side by side on random expressions (see
+ * workload.h) and on random values, many of them awkward ones: NaNs,
+ * infinities, zeros of both signs, subnormals, arbitrary bit patterns.
+ *   checked  range-checked iteration (see std_lib_facilities.h), which has
+ *            to throw Range_error whether or not subscripts are checked
+ *   random   the random numbers everything else is made of: scripts and
+ *            filled buffers written on several threads at once, one stream
+ *            each, against the same streams written one after the other
+ *   numbers  parse_number() (see numbers.h) against from_chars(), on
+ *            literals at the edges of its fast path, and its SWAR digit
+ *            tests against taking digits one at a time
+ *   lexer    Token_streams reading through buffers of a few bytes, in
+ *            line and block mode, against scanning the text in place: the
+ *            same tokens where they straddle refills
+ *   ignore   skipping to the next ';' (Token_stream::ignore()) through
+ *            small buffers, against the text scanned in place, with
+ *            tokens in the lookahead or not; and skipping a megabyte
+ *   errors   statements that fail, in every way: the message and the
+ *            offset of the Calc_error (see status.h), and what the
+ *            throwing functions throw
+ *   parse    the parser's explicit stack against recursive descent, on
+ *            expressions with bits missing or extra: the same code, or
+ *            the same error, and the same place to go on from; and
+ *            nesting a million deep
+ *   output   what an Output (see output.h) writes, in every precision and
+ *            with buffers big and small, against operator<<
+ *   jit      expressions compiled to machine code (see jit.h)
+ *   kernels  every set of vector kernels the CPU can run against the
+ *            plain loops (see kernels.h), for doubles and floats, at every
+ *            length up to a few vectors
+ *   batch    expressions over columns of rows (see batch.h), against
+ *            running them row by row, in double and in float: the same
+ *            results, or the error of the first row that fails
+ *   parallel the same on several threads, against one thread, over
+ *            enough rows for several chunks each
+ *   pipeline calculating a stream on three threads (see pipeline.h)
+ *            against calculate_unprompted(), on scripts with errors
+ *   mapped   damaged scripts scanned in place, in a mapped file (see
+ *            mapped_file.h), against reading them through an istream
+ *   server   a server's connections (see server.h) against
+ *            calculate_unprompted(), on scripts arriving in pieces
+ *   reactive reactive Sessions (see reactive.h) against recomputing every
+ *            formula after every assignment
+ *   memo     the memo (see memo.h) against the interpreter, in every
+ *            precision, as the variables change around it
+ *   cache    damaged cache files (see script_cache.h): a file that is cut
+ *            short, or has code that can't run, must not be loaded, and
+ *            one with random bytes changed must not be loaded, or else
+ *            must replay without going wrong (build with
+ *            -fsanitize=address to have that checked closely)
+ * It prints how many results it compared and the first few that differ,
+ * and fails if any did.
+ *
+ * Build it like the calculator:
+ *         g++ -std=c++17 -O2 -pthread check.cpp -o check
+ * and keep the -O2 when adding sanitizers: which of two NaNs a scalar + or
+ * * passes on is up to the compiler, which may swap the operands, and at
+ * -O2 GCC makes the choice the JIT and the kernels make. It has to pass
+with -DPPP_UNCHECKED too.
+ * usage: check [-s seeds]
+ */
+#include "../lib/std_lib_facilities.h"
+#include "batch.h"
+#include "calculator.h"
+#include "jit.h"
+#include "kernels.h"
+#include "mapped_file.h"
+#include "memo.h"
+#include "parser.h"
+#include "pipeline.h"
+#include "script_cache.h"
+#include "server.h"
+#include "session.h"
+#include "workload.h"
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <set>
+
+// expressions for the operators' edge cases, which workload.h (whose
+// divisors are never zero) doesn't write
+const vector<string> edge_cases = {
+    "a % b",       "b % a",         "-a % -b",           "a / b",
+    "0 % a",       "-0 % a",        "(a - b) / (c - d)", "(a * b) % (c + d)",
+    "a % (b * 0)", "a % b % c % d", "-(a % b)",          "a * b + c / d",
+    "a % d + c / b", "a / b % c",
+};
+
+// the unsigned integer as wide as T (a float or a double)
+template <class T>
+using Bits_of = conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+
+// a value to try: mostly awkward ones
+template <class T = double> T awkward() {
+  using L = numeric_limits<T>;
+  static const T special[] = {
+      T(0),           -T(0),           T(1),          -T(1),
+      T(0.5),         T(3),            L::max(),      -L::max(),
+      L::denorm_min(), -L::denorm_min(), L::infinity(), -L::infinity(),
+      L::quiet_NaN(), -L::quiet_NaN(),
+  };
+  const int n = sizeof(special) / sizeof(special[0]);
+  const int k = randint(n + 2);
+  if (k < n)
+    return special[k];
+  const uint64_t r = uint64_t(randint(numeric_limits<int>::max())) << 33 ^
+                     uint64_t(randint(numeric_limits<int>::max()));
+  Bits_of<T> bits = Bits_of<T>(r >> (64 - 8 * sizeof(T)));
+  if (k == n) { // a NaN with some payload, of either sign
+    const T inf = L::infinity();
+    Bits_of<T> exponent;
+    memcpy(&exponent, &inf, sizeof inf);
+    bits |= exponent | 1;
+  }
+  T d;
+  memcpy(&d, &bits, sizeof d);
+  return d;
+}
+
+// a value to try in T, whatever T is: awkward() ones for a float or a
+// double, awkward doubles for the wider numbers
+template <class T> T awkward_value() {
+  if constexpr (is_same_v<T, float> || is_same_v<T, double>)
+    return awkward<T>();
+  else
+    return T(awkward<double>());
+}
+
+// the bits of the value (see memo.h), not of any padding after them
+template <class T> bool same_bits(T a, T b) {
+  return memcmp(&a, &b, value_bytes<T>) == 0;
+}
+
+bool same(float a, float b) { return same_bits(a, b); }
+bool same(double a, double b) { return same_bits(a, b); }
+bool same(long double a, long double b) { return same_bits(a, b); }
+bool same(const Compensated &a, const Compensated &b) {
+  return same_bits(a, b);
+}
+
+// are a and b the same result: the same bits, or the same error
+template <class T> bool same(const Expected<T> &a, const Expected<T> &b) {
+  if (bool(a) != bool(b))
+    return false;
+  if (!a)
+    return a.error().code == b.error().code && a.error().id == b.error().id;
+  return same(*a, *b);
+}
+
+template <class T> string show(const T &d) {
+  unsigned char bytes[sizeof(T)];
+  memcpy(bytes, &d, sizeof bytes);
+  ostringstream os;
+  os << d << " (" << hex << setfill('0');
+  for (size_t i = value_bytes<T>; i > 0; --i) // most significant first
+    os << setw(2) << int(bytes[i - 1]);
+  os << ')';
+  return os.str();
+}
+
+template <class T> string show(const Expected<T> &r) {
+  if (!r)
+    return "error " + to_string(int(r.error().code));
+  return show(*r);
+}
+
+// the results compared, and how many differed
+struct Tally {
+  long compared{0};
+  long differed{0};
+
+  // is got what we want; if not, say so (for the first few)
+  template <class R>
+  bool compare(const string &what, const string &expression, const R &want,
+               const R &got) {
+    ++compared;
+    if (same(want, got))
+      return true;
+    if (differed++ < 5)
+      cout << what << ": " << expression << ": want " << show(want)
+           << ", got " << show(got) << '\n';
+    return false;
+  }
+
+  // a check with no result to show: is ok true
+  bool expect(bool ok, const string &what, const string &why) {
+    ++compared;
+    if (!ok && differed++ < 5)
+      cout << what << ": " << why << '\n';
+    return ok;
+  }
+
+  bool report(const string &what) const {
+    cout << left << setw(8) << what << right << setw(10) << compared
+         << " results, " << differed << " differed\n";
+    return differed == 0;
+  }
+};
+
+// a character for the SWAR digit tests: a digit mostly, or one that is
+// nearly one ('/' and ':' are next to '0' and '9'; 0xB0 to 0xB9 and 0x10
+// to 0x19 differ from digits in one bit)
+char near_digit() {
+  static const char others[] = "/:.eE+-x \xB0\xB5\xB9\x10\x19\x7F";
+  if (randint(3))
+    return char('0' + randint(9));
+  return others[randint(size(others) - 2)];
+}
+
+// a random literal, near the edges of parse_number()'s fast path: digit
+// runs either side of 8, 16 and 19 long, many leading zeros, significands
+// near 2^53, exponents either side of 22, and something after it
+string literal() {
+  static const string significands[] = {
+      "9007199254740992", "9007199254740993", "9007199254740991",
+      "18446744073709551615", "18446744073709551616", "1234567890123456789",
+      "12345678901234567890", "0.000000000000000000001", "00000000000000000001",
+      "4.9406564584124654e-324", "2.2250738585072014e-308",
+      "1.7976931348623157e308", "1.7976931348623159e308", "."};
+  string s;
+  if (randint(3) == 0) {
+    s = significands[randint(size(significands) - 1)];
+  } else {
+    for (int k = randint(3) == 0 ? randint(30) : 0; k > 0; --k)
+      s += '0';
+    for (int k = randint(25); k > 0; --k)
+      s += char('0' + randint(9));
+    if (randint(1)) {
+      s += '.';
+      for (int k = randint(25); k > 0; --k)
+        s += char('0' + randint(9));
+    }
+  }
+  if (randint(1)) {
+    s += "eE"[randint(1)];
+    if (randint(1))
+      s += "+-"[randint(1)];
+    if (randint(5))
+      s += to_string(randint(2) ? randint(30) : randint(400));
+  }
+  for (int k = randint(3); k > 0; --k)
+    s += near_digit();
+  return s;
+}
+
+// parse_number() against from_chars(), on random literals cut off at
+// random, in buffers no longer than the text: the same value, to the bit,
+// the same end and the same error; a Compensated with the same hi, and a
+// lo that gets within rounding of the literal as a long double has it.
+// And the SWAR digit tests against taking the digits a byte at a time
+void check_numbers(int seed, Tally &t) {
+  seed_randint(seed);
+  for (int i = 0; i < 2000; ++i) {
+    const string s = literal();
+    const vector<char> text(s.begin(), s.begin() + randint(s.size()));
+    const char *first = text.data(), *last = first + text.size();
+    const string shown = '"' + string(first, last) + '"';
+    double want = -1, got = -1;
+    const from_chars_result a = from_chars(first, last, want);
+    const from_chars_result b = parse_number(first, last, got);
+    t.expect(a.ptr == b.ptr && a.ec == b.ec, "numbers",
+             shown + ": not where from_chars() ends, or not its error");
+    if (a.ec == errc{})
+      t.compare("numbers", shown, want, got);
+
+    Compensated c;
+    const from_chars_result r = parse_number(first, last, c);
+    t.expect(r.ptr == b.ptr && r.ec == b.ec && (b.ec != errc{} ||
+                                                same(c.hi, got)),
+             "numbers", shown + ": a Compensated's hi isn't the double");
+    long double wide;
+    if (b.ec == errc{} && c.lo != 0 &&
+        from_chars(first, last, wide).ec == errc{} && isnormal(wide)) {
+      const long double sum = (long double)c.hi + c.lo;
+      t.expect(fabsl(sum - wide) <= fabsl(wide) * 0x1p-62L, "numbers",
+               shown + ": a Compensated's lo is wrong");
+    }
+  }
+
+  for (int i = 0; i < 2000; ++i) {
+    char p[8];
+    for (char &ch : p)
+      ch = near_digit();
+    bool digits = true;
+    uint32_t value = 0;
+    for (char ch : p) {
+      digits &= '0' <= ch && ch <= '9';
+      value = value * 10 + uint32_t(ch - '0');
+    }
+    const string shown = '"' + string(p, 8) + '"';
+    t.expect(eight_digits(p) == digits, "numbers",
+             shown + ": eight_digits() is wrong");
+    if (digits)
+      t.expect(eight_digits_value(p) == value, "numbers",
+               shown + ": eight_digits_value() is wrong");
+    const char *end = p;
+    while (end < p + 8 && '0' <= *end && *end <= '9')
+      ++end;
+    t.expect(digits_end(p, p + 8) == end, "numbers",
+             shown + ": digits_end() is wrong");
+  }
+}
+
+// text for the lexer: n random pieces, with the tokens most likely to be
+// cut by a refill (long names, long literals, exponents without digits)
+string lexer_text(int n) {
+  static const string pieces[] = {"let", "q", ";", "=", "(", ")", "+", "-",
+                                  "*", "/", "%", "#", "$", ".", "1e", "1e+",
+                                  "2E-7", ".5", "1.", "1.2.3", "0.1e10"};
+  string s;
+  for (int i = 0; i < n; ++i) {
+    switch (randint(3)) {
+    case 0:
+      s += pieces[randint(size(pieces) - 1)];
+      break;
+    case 1: // a name
+      s += char('a' + randint(25));
+      for (int k = randint(40); k > 0; --k)
+        s += randint(3) ? char('a' + randint(25)) : char('0' + randint(9));
+      break;
+    default: // a literal
+      for (int k = randint(30); k >= 0; --k)
+        s += char('0' + randint(9));
+      if (randint(1))
+        s += '.' + to_string(randint(999999));
+      if (randint(2) == 0)
+        s += "e" + to_string(randint(-400, 400));
+      break;
+    }
+    s += " \n\t"[randint(2)];
+    if (randint(3) == 0)
+      s += string(randint(1, 20), ' ');
+  }
+  return s;
+}
+
+// all of ts's tokens, up to the quit at the end, and where each starts
+void lex(Token_stream &ts, vector<Token> &tokens, vector<long> &where) {
+  do {
+    tokens.push_back(ts.get());
+    where.push_back(ts.position());
+  } while (tokens.back().kind != quit);
+}
+
+// the tokens of random text read through buffers of a few bytes (a token
+// seldom fits, and a literal or a name is cut anywhere), in both modes and
+// both widths, against the text scanned in place: the same kinds, names,
+// values (to the bit) and offsets
+void check_lexer(int seed, Tally &t) {
+  seed_randint(seed);
+  const string text = lexer_text(300);
+  for (const bool wide : {false, true}) {
+    Symbol_names names;
+    vector<Token> want;
+    vector<long> want_at;
+    Token_stream whole{names, text};
+    whole.set_wide(wide);
+    lex(whole, want, want_at);
+    for (const int capacity : {1, 2, 3, 5, 8, 13, 64, 4096})
+      for (const auto mode :
+           {Token_stream::Mode::line, Token_stream::Mode::block}) {
+        Symbol_names got_names;
+        istringstream in{text};
+        Token_stream ts{got_names, in, mode, capacity};
+        ts.set_wide(wide);
+        vector<Token> got;
+        vector<long> got_at;
+        lex(ts, got, got_at);
+        const string what =
+            "seed " + to_string(seed) + ", capacity " + to_string(capacity) +
+            (mode == Token_stream::Mode::line ? ", line" : ", block");
+        if (!t.expect(got.size() == want.size(), "lexer",
+                      what + ": " + to_string(got.size()) + " tokens, not " +
+                          to_string(want.size())))
+          continue;
+        for (size_t i = 0; i < want.size(); ++i) {
+          const Token &a = want[i], &b = got[i];
+          const bool ok = a.kind == b.kind && a.id == b.id &&
+                          same(a.value, b.value) && want_at[i] == got_at[i];
+          if (!t.expect(ok, "lexer",
+                        what + ": token " + to_string(i) + " at " +
+                            to_string(want_at[i]) + " is " + b.kind +
+                            ", not " + a.kind))
+            break;
+        }
+      }
+  }
+}
+
+// a statement that fails, what it fails with, and the offset in it of
+// what's at fault: the bad token, or the start of the statement for an
+// error found when running it
+struct Failing {
+  string statement, message;
+  long at;
+};
+
+const vector<Failing> failing = {
+    {"2 * ;", "primary expected", 4},
+    {"(1 + (2 * 3);", "')' expected", 12},
+    {"let = 3;", "name expected in declaration", 4},
+    {"let 3 = 1;", "name expected in declaration", 4},
+    {"let x 3;", "= missing in declartion of x", 6},
+    {"let # = 1;", "Bad token", 4},
+    {"let x # 1;", "Bad token", 6},
+    {"let x = #;", "Bad token", 8},
+    {"1 # 2;", "Bad token", 2},
+    {"(1 + 2 #;", "Bad token", 7},
+    {"  $;", "Bad token", 2},
+    {"-(a / b);", "divide by zero", 0},
+    {"  a % b;", "%:divide by zero", 2},
+    {"1 + y;", "get: undefined variable y", 0},
+    {"let a = 2;", "a declared twice", 0},
+    {"let pi = 3;", "pi declared twice", 0},
+    {"z = 1;", "set: undefined variable z", 0},
+    {"pi = 3;", "set: can't assign to constant pi", 0},
+    {"e = a;", "set: can't assign to constant e", 0},
+};
+
+// each failing statement after a few good ones, in T, through
+// try_statement() and through statement(): the Calc_error's message and
+// offset (from the start of the input), and the text statement() throws
+template <class T> void check_errors(Tally &t) {
+  const string before = "let a = 1; let b = 0;\n  a + b;\n";
+  for (const Failing &f : failing) {
+    const string text = before + f.statement + '\n';
+    Basic_session<T> s{text};
+    Basic_code<T> c;
+    for (int i = 0; i < 3; ++i) {
+      if (!try_statement(s, c))
+        error("check_errors: ", before);
+      s.ts.get(); // the ';'
+    }
+    const Expected<T> r = try_statement(s, c);
+    const long at = long(before.size()) + f.at;
+    if (!t.expect(!r, "errors", f.statement + ": no error"))
+      continue;
+    const string m = message(r.error(), s.names);
+    t.expect(m == f.message, "errors",
+             f.statement + ": \"" + m + "\", not \"" + f.message + '"');
+    t.expect(r.error().pos == at, "errors",
+             f.statement + ": at " + to_string(r.error().pos) + ", not " +
+                 to_string(at));
+
+    Basic_session<T> thrower{text};
+    string thrown;
+    try {
+      for (int i = 0; i < 4; ++i) {
+        statement(thrower);
+        thrower.ts.get();
+      }
+    } catch (runtime_error &x) {
+      thrown = x.what();
+    }
+    t.expect(thrown == f.message, "errors",
+             f.statement + ": statement() threw \"" + thrown + '"');
+  }
+}
+
+// the grammar at the top of parser.h as recursive descent, the way the
+// parser used to be written: the reference for its explicit stack; emits
+// the same code, without optimizing it
+bool descent_expression(Token_stream &ts, Code &c, Calc_error &e);
+
+bool descent_primary(Token_stream &ts, Code &c, Calc_error &e) {
+  Token t = ts.get();
+  switch (t.kind) {
+  case '(':
+    if (!descent_expression(ts, c, e))
+      return false;
+    t = ts.get();
+    if (t.kind == bad)
+      return fail(e, Errc::bad_token, ts.position());
+    if (t.kind != ')')
+      return fail(e, Errc::rparen_expected, ts.position());
+    return true;
+  case '-':
+    if (!descent_primary(ts, c, e))
+      return false;
+    c.emit(Op::negate);
+    return true;
+  case '+':
+    return descent_primary(ts, c, e);
+  case number:
+    c.emit_number(t.value.hi);
+    return true;
+  case name:
+    c.emit(Op::load, t.id);
+    return true;
+  case bad:
+    return fail(e, Errc::bad_token, ts.position());
+  default:
+    return fail(e, Errc::primary_expected, ts.position());
+  }
+}
+
+bool descent_term(Token_stream &ts, Code &c, Calc_error &e) {
+  if (!descent_primary(ts, c, e))
+    return false;
+  for (char k; (k = ts.peek().kind) == '*' || k == '/' || k == '%';) {
+    ts.get();
+    if (!descent_primary(ts, c, e))
+      return false;
+    c.emit(k == '*' ? Op::mul : k == '/' ? Op::div : Op::mod);
+  }
+  return true;
+}
+
+bool descent_expression(Token_stream &ts, Code &c, Calc_error &e) {
+  if (!descent_term(ts, c, e))
+    return false;
+  for (char k; (k = ts.peek().kind) == '+' || k == '-';) {
+    ts.get();
+    if (!descent_term(ts, c, e))
+      return false;
+    c.emit(k == '+' ? Op::add : Op::sub);
+  }
+  return true;
+}
+
+// a script of random expressions nested depth deep, with characters
+// deleted, doubled or put in here and there so that many of them fail
+string damaged_expressions(int seed, int depth) {
+  Workload w{seed, {"a", "b", "pi"}};
+  w.max_depth = depth;
+  string s;
+  for (int i = 0; i < 200; ++i) {
+    string e = w.expression() + ';';
+    for (int k = randint(2); k > 0; --k) {
+      const int at = randint(e.size() - 1);
+      switch (randint(3)) {
+      case 0:
+        e.erase(at, 1);
+        break;
+      case 1:
+        e.insert(at, 1, e[at]);
+        break;
+      default:
+        e.insert(at, 1, "()-+#;"[randint(5)]);
+      }
+    }
+    s += e + '\n';
+  }
+  return s;
+}
+
+// the parser's expression() against recursive descent, on damaged
+// expressions: the same code (before optimizing) or the same error, at the
+// same place, and the input left at the same token, statement after
+// statement, recovering from each error the way calculate() does
+void check_parse(int seed, Tally &t) {
+  const string text = damaged_expressions(seed, 2 + seed % 12);
+  Symbol_names names, ref_names;
+  Token_stream ts{names, text}, ref{ref_names, text};
+  Arena scratch;
+  Code c, want;
+  while (ref.peek().kind != quit) {
+    Calc_error e, ref_e;
+    c.clear();
+    want.clear();
+    const long at = ref.next_position();
+    const bool ok = expression(ts, c, e, scratch);
+    const bool ref_ok = descent_expression(ref, want, ref_e);
+    const string what = "seed " + to_string(seed) + ", at " + to_string(at);
+    bool same_code = c.code.size() == want.code.size() &&
+                     c.constants.size() == want.constants.size();
+    for (size_t i = 0; same_code && i < c.code.size(); ++i)
+      same_code = c.code[i].op == want.code[i].op &&
+                  c.code[i].arg == want.code[i].arg;
+    for (size_t i = 0; same_code && i < c.constants.size(); ++i)
+      same_code = same(c.constants[i], want.constants[i]);
+    if (!t.expect(ok == ref_ok && e.code == ref_e.code && e.pos == ref_e.pos &&
+                      same_code && ts.next_position() == ref.next_position(),
+                  "parse", what + ": not what recursive descent does"))
+      return;
+    if (ok && ref.peek().kind == print) {
+      ts.get();
+      ref.get();
+    } else {
+      ts.ignore(print);
+      ref.ignore(print);
+    }
+  }
+  t.expect(ts.peek().kind == quit, "parse", "input left over");
+}
+
+// nesting far deeper than recursion could go: a million parentheses, a
+// million minus signs, and parentheses left open
+void check_deep(Tally &t) {
+  const int n = 1000000;
+  const string cases[] = {
+      string(n, '(') + "2" + string(n, ')') + ';',
+      string(n, '-') + "2;",
+      string(n + 1, '-') + "2;",
+      string(n / 2, '(') + "-(" + string(n / 2, '-') + "3 * 2)" +
+          string(n / 2, ')') + ';',
+      string(n, '(') + "2" + string(n - 1, ')') + ';',
+  };
+  const double want[] = {2, 2, -2, -6}; // and the last one fails
+  for (int i = 0; i < int(size(cases)); ++i) {
+    Session s{cases[i]};
+    Code c;
+    const Expected<double> r = try_statement(s, c);
+    if (i < int(size(want))) {
+      t.compare("deep", "case " + to_string(i), Expected<double>{want[i]}, r);
+    } else {
+      const bool ok = !r && r.error().code == Errc::rparen_expected &&
+                      r.error().pos == long(cases[i].size()) - 1;
+      t.expect(ok, "deep", "an unclosed '(' isn't reported at the ';'");
+    }
+  }
+}
+
+// a number for Output to write: an awkward one, one near where %g rounds
+// up to another digit or switches to an exponent, or (wider than a
+// double) one past a double's range
+template <class T> T output_value() {
+  static const double edges[] = {
+      0.0001,  0.00009999995, 0.0000999994, 999999.0, 999999.5,
+      9999995, 123456.5,      1e-5,         1e16,     0.1,
+      1.0 / 3, 2.5,           3.5,          1e21,     4.35,
+  };
+  switch (randint(3)) {
+  case 0:
+    return T(edges[randint(size(edges) - 1)] * (randint(1) ? 1 : -1));
+  case 1:
+    if constexpr (wider_than_double<T>)
+      return T(awkward<double>()) * T(1e300) * T(1e300);
+    [[fallthrough]];
+  default:
+    return awkward_value<T>();
+  }
+}
+
+// what an Output with room for capacity characters writes for a random
+// mix of Ts, strings and characters, against writing them with operator<<
+template <class T> void check_output(int seed, size_t capacity, Tally &t) {
+  seed_randint(seed);
+  ostringstream want, got;
+  {
+    Output o{got, capacity};
+    for (int i = 0; i < 500; ++i)
+      switch (randint(3)) {
+      case 0: { // longer than the buffer, now and then
+        const string s(randint(80), char('a' + randint(25)));
+        want << s;
+        o.put(s);
+        break;
+      }
+      case 1:
+        want << "= ";
+        o.put('=');
+        o.put(' ');
+        break;
+      default: {
+        const T d = output_value<T>();
+        want << d << '\n';
+        o.put(d);
+        o.put('\n');
+      }
+      }
+  } // flushed here
+  const string &a = want.str(), &b = got.str();
+  if (a == b) {
+    t.expect(true, "output", "");
+    return;
+  }
+  const size_t i = mismatch(a.begin(), a.end(), b.begin(), b.end()).first -
+                   a.begin();
+  t.expect(false, "output",
+           "seed " + to_string(seed) + ", capacity " + to_string(capacity) +
+               ": \"" + b.substr(i, 20) + "\", not \"" + a.substr(i, 20) +
+               '"');
+}
+
+// statements, some of them garbage with no token in it that parses, and
+// some of those much longer than a small buffer
+string garbage_text(int seed) {
+  Workload w{seed, {"a", "b"}};
+  string s;
+  for (int i = 0; i < 100; ++i) {
+    if (randint(2) == 0) {
+      for (int k = randint(200); k >= 0; --k)
+        s += "#$ (a1)*."[randint(8)];
+      s += ';';
+    } else {
+      s += w.expression() + ';';
+    }
+    s += randint(3) ? " " : "\n";
+  }
+  return s;
+}
+
+// calls of get(), peek() and ignore(print), at random, on a Token_stream
+// reading through a small buffer and on one scanning the text in place:
+// the same tokens at the same offsets, and ignore() stopping at the same
+// ';', whether that is a token in the lookahead or a character not yet
+// scanned; then a statement of a megabyte of garbage, skipped in one go
+void check_ignore(int seed, Tally &t) {
+  const string text = garbage_text(seed);
+  vector<int> ops(400);
+  randint(ops.begin(), ops.end(), 0, 5);
+  for (const int capacity : {1, 7, 64, Token_stream::block_size})
+    for (const auto mode :
+         {Token_stream::Mode::line, Token_stream::Mode::block}) {
+      Symbol_names names, ref_names;
+      istringstream in{text};
+      Token_stream ts{names, in, mode, capacity}, ref{ref_names, text};
+      const string what = "seed " + to_string(seed) + ", capacity " +
+                          to_string(capacity) + ", op ";
+      bool ok = true;
+      size_t i = 0;
+      for (; ok && i < ops.size(); ++i)
+        if (ops[i] < 3) {
+          const Token a = ref.get(), b = ts.get();
+          ok = a.kind == b.kind && a.id == b.id &&
+               ref.position() == ts.position();
+        } else if (ops[i] < 5) {
+          const int k = ops[i] == 3 ? 0 : 3;
+          ok = ref.peek(k).kind == ts.peek(k).kind;
+        } else {
+          ok = ref.ignore(print) == ts.ignore(print) &&
+               ref.next_position() == ts.next_position();
+        }
+      t.expect(ok, "ignore", what + to_string(i - 1) + " differs");
+    }
+
+  const string big =
+      "1 + (" + string(1 << 20, '#') + "(;" + string(1 << 19, '$') + ";2;";
+  istringstream in{big};
+  Session s{in, Token_stream::Mode::block};
+  Code c;
+  const Expected<double> r = try_statement(s, c);
+  t.expect(!r && s.ts.ignore(print) && s.ts.ignore(print) &&
+               s.ts.next_position() == long(big.size()) - 2 &&
+               s.ts.get().kind == number,
+           "ignore", "a megabyte of garbage");
+}
+
+// the expressions for one seed: the edge cases, and n random ones in a, b,
+// c and d
+vector<string> expressions(int seed, int n) {
+  Workload w{seed, {"a", "b", "c", "d", "pi", "e"}};
+  w.max_depth = 5;
+  w.max_terms = 4;
+  vector<string> v = edge_cases;
+  for (int i = 0; i < n; ++i)
+    v.push_back(w.expression());
+  return v;
+}
+
+const string vars[] = {"a", "b", "c", "d"};
+
+// does f throw the Range_error for index i
+template <class F> bool throws_range_error(F f, int i) {
+  try {
+    f();
+  } catch (Range_error &e) {
+    return e.index == i;
+  }
+  return false;
+}
+
+// checked() on a vector and a String: going through them gives their
+// elements, and using an iterator at the end throws, in a build that
+// checks subscripts and in one that doesn't; the subscripts themselves are
+// checked only in the first
+void check_checked(Tally &t) {
+  vector<int> v{1, 2, 3, 4, 5};
+  String s;
+  s += "abc";
+  int sum = 0;
+  for (int i : checked(v))
+    sum += i;
+  string copy;
+  for (char c : checked(s))
+    copy += c;
+  t.expect(sum == 15 && copy == "abc", "checked", "didn't go through it all");
+
+  const auto cv = checked(v);
+  const auto cs = checked(s);
+  t.expect(throws_range_error([&] { (void)*cv.end(); }, 5), "checked",
+           "*end() of a vector");
+  t.expect(throws_range_error([&] { (void)cv.begin()[5]; }, 5), "checked",
+           "begin()[size()] of a vector");
+  t.expect(throws_range_error([&] { (void)*cs.end(); }, 3), "checked",
+           "*end() of a String");
+  t.expect(*(cv.end() - 1) == 5 && cs.begin()[2] == 'c', "checked",
+           "the last element");
+
+  if (PPP_RANGE_CHECK) {
+    t.expect(throws_range_error([&] { (void)v[5]; }, 5), "checked",
+             "v[size()]");
+    t.expect(throws_range_error([&] { (void)s[3]; }, 3), "checked",
+             "s[size()]");
+  }
+}
+
+// what stream stream of seed gives: a script, then a buffer of numbers
+string from_stream(int seed, int stream) {
+  Workload w{seed, stream, {"a", "b", "c", "d"}};
+  string s = w.script(40);
+  vector<int> v(200);
+  randint(v.begin(), v.end(), -5, 5);
+  for (int i : v) {
+    if (i < -5 || 5 < i)
+      return "out of range: " + to_string(i);
+    s += to_string(i) + ' ';
+  }
+  return s;
+}
+
+// the streams of one seed written on threads of their own, each twice,
+// against writing them here one after the other; another seed, or stream,
+// has to give something else
+void check_random(int seed, Tally &t) {
+  const int streams = 4;
+  vector<string> got(streams), again(streams);
+  vector<thread> threads;
+  for (int i = 0; i < streams; ++i)
+    threads.emplace_back([&, i] {
+      got[i] = from_stream(seed, i);
+      again[i] = from_stream(seed, i);
+    });
+  for (thread &th : threads)
+    th.join();
+  for (int i = 0; i < streams; ++i) {
+    const string want = from_stream(seed, i);
+    const string what = "seed " + to_string(seed) + " stream " + to_string(i);
+    t.expect(got[i] == want, "random", what + " differs on a thread");
+    t.expect(again[i] == want, "random", what + " differs the second time");
+    t.expect(want != from_stream(seed + 1, i), "random",
+             what + " is the same as for the next seed");
+    if (i > 0)
+      t.expect(want != got[i - 1], "random",
+               what + " is the same as the stream before");
+  }
+}
+
+// a Session of Ts to compile es in, one after the other, with a, b, c and
+// d declared; text keeps the input
+template <class T = double>
+unique_ptr<Basic_session<T>> session_for(const vector<string> &es,
+                                         string &text) {
+  text.clear();
+  for (const string &e : es)
+    text += e + ";\n";
+  auto s = make_unique<Basic_session<T>>(text);
+  for (const string &v : vars)
+    define_name(s->names, v, 0);
+  return s;
+}
+
+// compile e, the next statement of s, into c
+template <class T>
+void compile_next(Basic_session<T> &s, const string &e, Basic_code<T> &c) {
+  while (s.ts.peek().kind == print)
+    s.ts.get();
+  if (!try_compile_statement(s, c).ok())
+    error("can't compile ", e);
+  s.ts.get(); // the ';'
+}
+
+// the JIT against the interpreter: the expressions of one seed, each run
+// on several sets of values
+void check_jit(int seed, Tally &t) {
+  const vector<string> es = expressions(seed, 500);
+  string text;
+  unique_ptr<Session> s = session_for(es, text);
+  Jit_memory m;
+  Code c;
+  for (const string &e : es) {
+    compile_next(*s, e, c);
+    Native_code n; // if it can't be compiled, run() interprets
+    n.compile(c.view(), s->names, m);
+    for (int k = 0; k < 20; ++k) {
+      for (const string &v : vars)
+        s->names.set(s->names.find(v), awkward());
+      t.compare("jit", e, try_evaluate(c, s->names),
+                n.run(c.view(), s->names));
+    }
+  }
+}
+
+// the kernels k against the plain loops, on n values
+template <class T>
+void check_kernels(const Kernels_for<T> &k, int n, Tally &t) {
+  using Kernel = void (*)(T *, const T *, const T *, int);
+  const Kernel ops[][2] = {
+      {k.add, add_plain<T>}, {k.sub, sub_plain<T>}, {k.mul, mul_plain<T>},
+      {k.div, div_plain<T>}, {k.mod, mod_plain<T>},
+  };
+  const char *const op_names[] = {"+", "-", "*", "/", "%"};
+  vector<T> a(n), b(n), want(n), got(n);
+  for (int i = 0; i < n; ++i) {
+    a[i] = awkward<T>();
+    b[i] = awkward<T>();
+  }
+  const string what = string("kernels ") + k.name;
+  t.expect(k.any_zero(b.data(), n) == any_zero_plain(b.data(), n), what,
+           "any_zero() of " + to_string(n) + " values");
+  for (int op = 0; op < 5; ++op) {
+    ops[op][1](want.data(), a.data(), b.data(), n);
+    ops[op][0](got.data(), a.data(), b.data(), n);
+    for (int i = 0; i < n; ++i)
+      if (!t.compare(what, show(a[i]) + ' ' + op_names[op] + ' ' + show(b[i]),
+                     want[i], got[i]))
+        break;
+  }
+}
+
+// the expressions of one seed over rows of awkward values, computed in T by
+// a Basic_batch and by try_evaluate() a row at a time: either every row
+// succeeds, with the same results, or both fail
+template <class T> void check_batch(int seed, int rows, Tally &t) {
+  const vector<string> es = expressions(seed, 50);
+  string text;
+  unique_ptr<Basic_session<T>> s = session_for<T>(es, text);
+  Basic_batch<T> b;
+  vector<vector<T>> cols;
+  for (const string &v : vars) {
+    vector<T> col(rows);
+    for (T &d : col) { // zeros in a third of the runs (and / and % fail)
+      d = awkward<T>();
+      if (d == T(0) && seed % 3 != 0)
+        d = T(1);
+    }
+    cols.push_back(col);
+    b.bind(s->names.find(v), move(col));
+  }
+
+  vector<T> out(rows);
+  Basic_code<T> c;
+  for (const string &e : es) {
+    compile_next(*s, e, c);
+    string failure; // the batch's error, if any
+    try {
+      b.evaluate(c, s->names, out.data());
+    } catch (exception &x) {
+      failure = x.what();
+    }
+    string first; // the first row's to fail
+    for (int i = 0; i < rows; ++i) {
+      for (int k = 0; k < 4; ++k)
+        s->names.set(s->names.find(vars[k]), cols[k][i]);
+      Expected<T> r = try_evaluate(c, s->names);
+      if (!r && first.empty())
+        first = message(r.error(), s->names);
+      else if (r && failure.empty() && !t.compare("batch", e, *r, out[i]))
+        break;
+    }
+    t.expect(failure == first, "batch",
+             e + ": failed with \"" + failure + "\", not \"" + first + '"');
+  }
+}
+
+// what calculate_batch() writes, in T, for random expressions (with no
+// zero divisors) over a few rows of awkward values, against writing what
+// try_evaluate() gives for each row: every result, in T, not narrowed (a
+// Compensated writes its hi either way)
+template <class T> void check_batch_output(int seed, Tally &t) {
+  const int rows = 10;
+  Workload w{seed, {"a", "b", "c", "d"}};
+  vector<string> es;
+  for (int i = 0; i < 20; ++i)
+    es.push_back(w.expression());
+  string text;
+  unique_ptr<Basic_session<T>> s = session_for<T>(es, text);
+  unique_ptr<Basic_session<T>> row = session_for<T>(es, text);
+  Basic_batch<T> b;
+  vector<vector<T>> cols;
+  for (const string &v : vars) {
+    vector<T> col(rows);
+    for (T &d : col)
+      d = awkward_value<T>();
+    cols.push_back(col);
+    b.bind(s->names.find(v), move(col));
+  }
+  ostringstream got, err;
+  calculate_batch(*s, b, got, err);
+
+  ostringstream want;
+  Output o{want};
+  Basic_code<T> c;
+  for (const string &e : es) {
+    compile_next(*row, e, c);
+    for (int i = 0; i < rows; ++i) {
+      for (int k = 0; k < 4; ++k)
+        row->names.set(row->names.find(vars[k]), cols[k][i]);
+      Expected<T> r = try_evaluate(c, row->names);
+      if (!r)
+        error("batch output: ", e);
+      o.put(*r);
+      o.put('\n');
+    }
+  }
+  o.flush();
+  t.expect(got.str() == want.str() && err.str().empty(), "batch",
+           "calculate_batch() wrote\n" + got.str() + err.str());
+}
+
+// the expressions of one seed over rows enough for several chunks, with a
+// zero or two in each column, at random, computed by a Basic_batch on one
+// thread and by one on several (the same one each time, so its threads are
+// kept): the same results in every row, or the same error
+template <class T> void check_parallel(int seed, Tally &t) {
+  const int rows = 4 * batch_chunk + 1000; // the last chunk short
+  const vector<string> es = expressions(seed, 20);
+  string text;
+  unique_ptr<Basic_session<T>> s = session_for<T>(es, text);
+  Basic_batch<T> one, many;
+  many.set_threads(3); // uneven shares, and stealing
+  for (const string &v : vars) {
+    vector<T> col(rows);
+    for (T &d : col)
+      if ((d = awkward<T>()) == T(0))
+        d = T(1);
+    for (int n = randint(2); n > 0; --n)
+      col[randint(rows - 1)] = T(0);
+    one.bind(s->names.find(v), col);
+    many.bind(s->names.find(v), move(col));
+  }
+
+  vector<T> want(rows), got(rows);
+  Basic_code<T> c;
+  for (const string &e : es) {
+    compile_next(*s, e, c);
+    string want_error, got_error;
+    try {
+      one.evaluate(c, s->names, want.data());
+    } catch (exception &x) {
+      want_error = x.what();
+    }
+    try {
+      many.evaluate(c, s->names, got.data());
+    } catch (exception &x) {
+      got_error = x.what();
+    }
+    if (!t.expect(want_error == got_error, "parallel",
+                  e + ": \"" + got_error + "\", not \"" + want_error + '"'))
+      continue;
+    if (!want_error.empty())
+      continue;
+    int i = 0; // the first row that differs
+    while (i < rows && same(want[i], got[i]))
+      ++i;
+    if (i < rows)
+      t.compare("parallel", e + " row " + to_string(i), want[i], got[i]);
+    t.compared += i;
+  }
+}
+
+// the expressions of one seed, with assignments to a, b, c and d among
+// them, run in two Sessions of Ts, one of them memoizing, over rounds of
+// new values for some of the variables (with the others left as they were,
+// so that what the memo knows stays good): the same results and the same
+// errors, every time
+template <class T> void check_memo(int seed, Tally &t) {
+  vector<string> es = expressions(seed, 100);
+  for (int k = 0; k < 20; ++k) {
+    const string e = vars[randint(3)] + " = " + es[randint(es.size() - 1)];
+    es.insert(es.begin() + randint(es.size()), e);
+  }
+  string text;
+  unique_ptr<Basic_session<T>> plain = session_for<T>(es, text);
+  unique_ptr<Basic_session<T>> memo = session_for<T>(es, text);
+  memo->memoize = true;
+  memo->memo = Basic_memo_cache<T>{256}; // small enough to evict
+  vector<Basic_code<T>> plain_codes(es.size()), memo_codes(es.size());
+  for (size_t i = 0; i < es.size(); ++i) {
+    compile_next(*plain, es[i], plain_codes[i]);
+    compile_next(*memo, es[i], memo_codes[i]);
+  }
+
+  for (int round = 0; round < 30; ++round) {
+    for (const string &v : vars)
+      if (randint(2) == 0) {
+        const T d = awkward_value<T>();
+        plain->names.set(plain->names.find(v), d);
+        memo->names.set(memo->names.find(v), d);
+      }
+    for (size_t i = 0; i < es.size(); ++i)
+      t.compare("memo", es[i], try_run(*plain, plain_codes[i].view()),
+                try_run(*memo, memo_codes[i].view()));
+  }
+}
+
+// statements that go wrong, for scripts to have among the good ones:
+// errors at run time, errors in parsing, and statements without their ';'
+// (after which what is skipped depends on whether the statement failed)
+const vector<string> bad_statements = {
+    "1/0;",        "1/0 2;",      "2 % 0 + 1 3 4;", "1 + 2 3;",
+    "let x = ;",   "(1 + 2;",     "let;",           "x = 1;",
+    "pi = 3;",     "let v1 = 2;", "$;",             "1 $ 2;",
+    "undeclared;", "2 * * 3;",    "1 2 3;",         ")(;",
+    "v1 = 1 2;",   ";;",          "let y = 1/0 3;",
+};
+
+// a random script with bad statements here and there, and perhaps without
+// a ';' (or with a "q") at the end
+string damaged_script(int seed) {
+  Workload w{seed};
+  istringstream lines{w.script(300)};
+  string script;
+  for (string line; getline(lines, line);) {
+    script += line + '\n';
+    if (randint(9) == 0)
+      script += bad_statements[randint(bad_statements.size() - 1)] + '\n';
+  }
+  switch (randint(3)) {
+  case 0:
+    script += "1 + 2"; // no ';'
+    break;
+  case 1:
+    script += "q 3;\n"; // not read
+    break;
+  }
+  return script;
+}
+
+// a damaged script in a file, calculated in Ts from the file mapped into
+// memory (as --mmap does) and through an istream: the same output and
+// errors, prompts and all. The file ends in the middle of a token, and for
+// every other seed exactly at the end of a page (of any size up to 64K),
+// where scanning one byte too far would fault
+template <class T> void check_mapped(int seed, Tally &t) {
+  static const string endings[] = {"", "12", "1.5e", "abc", "let x", "(1",
+                                   "#", ";"};
+  string script = damaged_script(seed);
+  const string ending = endings[randint(size(endings) - 1)];
+  if (seed % 2 == 0) {
+    const size_t page = 1 << 16;
+    script.resize((script.size() + ending.size() + page) / page * page -
+                      ending.size(),
+                  ' ');
+  }
+  script += ending;
+  const string path = (filesystem::temp_directory_path() /
+                       ("calc_check_" + to_string(seed) + ".txt"))
+                          .string();
+  ofstream{path, ios_base::binary} << script;
+
+  for (const bool prompts : {false, true}) {
+    ostringstream want, got;
+    {
+      istringstream in{script};
+      Basic_session<T> s{in, Token_stream::Mode::block};
+      prompts ? calculate(s, want, want) : calculate_unprompted(s, want, want);
+    }
+    {
+      Mapped_file f{path, Mapped_file::Access::sequential};
+      if (f.size() != script.size())
+        error("can't map ", path);
+      Basic_session<T> s{string_view{f.data(), f.size()}};
+      prompts ? calculate(s, got, got) : calculate_unprompted(s, got, got);
+    }
+    t.expect(want.str() == got.str(), "mapped",
+             "seed " + to_string(seed) + ": the output differs");
+  }
+  filesystem::remove(path);
+}
+
+// calculate_pipelined() against calculate_unprompted(), in Ts, on damaged
+// scripts: the same output, and the same errors in the same places
+template <class T> void check_pipeline(int seed, Tally &t) {
+  const string script = damaged_script(seed);
+  ostringstream want, got;
+  {
+    istringstream in{script};
+    Basic_session<T> s{in, Token_stream::Mode::block};
+    calculate_unprompted(s, want, want);
+  }
+  {
+    istringstream in{script}, none;
+    Basic_session<T> s{none};
+    calculate_pipelined(s, in, got, got);
+  }
+  t.expect(want.str() == got.str(), "pipeline",
+           "seed " + to_string(seed) + ": the output differs");
+}
+
+// a server's connection (see server.h) against calculate_unprompted(), on
+// damaged scripts arriving in random pieces, so that statements are split
+// between batches, and failed ones skipped from one batch into the next;
+// then the cases a connection has that cin hasn't
+void check_connection(int seed, Tally &t) {
+  const string script = damaged_script(seed);
+  ostringstream want;
+  {
+    istringstream in{script};
+    Session s{in, Token_stream::Mode::block};
+    calculate_unprompted(s, want, want);
+  }
+  Connection c;
+  string got;
+  bool open = true;
+  for (size_t at = 0; open && at < script.size();) {
+    const size_t n = min<size_t>(randint(1, 200), script.size() - at);
+    open = c.receive(script.data() + at, n, got);
+    at += n;
+  }
+  if (open)
+    c.finish(got);
+  t.expect(got == want.str(), "server",
+           "seed " + to_string(seed) + ": the replies differ");
+  if (seed != 1)
+    return;
+
+  // the pieces sent, the replies, and is the connection still open
+  struct Case {
+    vector<string> pieces;
+    string replies;
+    bool open;
+  };
+  const Case cases[] = {
+      {{"1/", "0 2", " 3;", "4;"}, "divide by zero\n= 4\n", true},
+      {{"2 * ;", "4;", "5;"}, "primary expected\n= 5\n", true},
+      {{"1; q", " 2;"}, "= 1\n", false}, // a quit
+      {{"1; 2"}, "= 1\n= 2\n", true},   // the end, without a ';'
+      {{"1 +", " 2"}, "= 3\n", true},
+  };
+  for (const Case &k : cases) {
+    Connection c;
+    string got;
+    bool open = true;
+    for (const string &p : k.pieces)
+      if (open)
+        open = c.receive(p.data(), p.size(), got);
+    if (open)
+      c.finish(got);
+    t.expect(got == k.replies && open == k.open, "server",
+             "\"" + k.pieces[0] + "\"...: the replies are \"" + got + '"');
+  }
+
+  // a statement too long to wait for the end of
+  Connection big;
+  const string digits(Connection::max_pending, '1');
+  big.receive(digits.data(), digits.size(), got);
+  t.expect(!big.too_long(), "server", "max_pending bytes are too long");
+  big.receive("1", 1, got);
+  t.expect(big.too_long(), "server", "max_pending + 1 bytes aren't too long");
+}
+
+// run the statement text (without its ';') in s, reading it from in, which
+// s reads from, as a server's connection does (see server.h)
+Expected<double> run_text(Session &s, istringstream &in, const string &text) {
+  in.clear();
+  in.str(text + ';');
+  Code c;
+  Expected<double> r = try_statement(s, c);
+  s.ts.ignore(print);
+  return r;
+}
+
+// the names formula f reads
+set<string> reads(const string &f) {
+  set<string> r;
+  string word;
+  for (char ch : f + ' ')
+    if (isalnum(static_cast<unsigned char>(ch))) {
+      word += ch;
+    } else {
+      if (!word.empty() && !isdigit(static_cast<unsigned char>(word[0])))
+        r.insert(word);
+      word.clear();
+    }
+  return r;
+}
+
+// reactive Sessions (see reactive.h) against recomputing, in order of
+// declaration, every formula that reads a variable that has changed, after
+// every assignment. The formulas are random,
+// over a, b, c, d and the variables declared before them, and some of them
+// divide by what can be zero; the assignments are to random variables,
+// inputs or not (a variable with a formula has none from then on). Every
+// variable must have the same value, and the same ones must be reported
+// stale
+void check_reactive(int seed, Tally &t) {
+  istringstream in, ref_in;
+  Session s{in, Token_stream::Mode::block};
+  Session ref{ref_in, Token_stream::Mode::block};
+  s.reactive = true;
+  vector<string> names = {"a", "b", "c", "d"};
+  vector<string> formulas(names.size()); // "" for an input
+  for (size_t k = 0; k < names.size(); ++k) {
+    run_text(s, in, "let " + names[k] + " = " + to_string(k + 1));
+    run_text(ref, ref_in, "let " + names[k] + " = " + to_string(k + 1));
+  }
+  for (int i = 0; i < 30; ++i) {
+    Workload w{seed * 100 + i, names};
+    string f = w.expression();
+    if (randint(3) == 0)
+      f = "(" + f + ") / (" + names[randint(names.size() - 1)] + " - " +
+          names[randint(names.size() - 1)] + ")";
+    const string let = "let v" + to_string(i) + " = " + f;
+    const bool ok = bool(run_text(s, in, let));
+    if (!t.expect(ok == bool(run_text(ref, ref_in, let)), "reactive", let))
+      return;
+    if (ok) {
+      names.push_back("v" + to_string(i));
+      formulas.push_back(f);
+    }
+  }
+
+  for (int round = 0; round < 100; ++round) {
+    const int k = randint(names.size() - 1);
+    const string assign = names[k] + " = " + to_string(randint(-3, 3));
+    run_text(s, in, assign);
+    run_text(ref, ref_in, assign);
+    formulas[k].clear();
+    // recompute, in order, each formula that reads something changed
+    set<string> changed = {names[k]};
+    vector<string> want_stale, got_stale;
+    for (size_t j = 0; j < names.size(); ++j) {
+      const set<string> r = reads(formulas[j]);
+      if (none_of(r.begin(), r.end(),
+                  [&](const string &v) { return changed.count(v); }))
+        continue;
+      if (run_text(ref, ref_in, names[j] + " = " + formulas[j]))
+        changed.insert(names[j]);
+      else
+        want_stale.push_back(names[j]);
+    }
+    for (const auto &f : s.dependencies.failures())
+      got_stale.push_back(s.names.name(f.var));
+    sort(want_stale.begin(), want_stale.end());
+    sort(got_stale.begin(), got_stale.end());
+    t.expect(want_stale == got_stale, "reactive",
+             assign + ": not the variables left stale");
+    for (const string &v : names)
+      if (!t.compare("reactive", assign + ": " + v, get_value(ref.names, v),
+                     get_value(s.names, v)))
+        break;
+  }
+}
+
+// the calculator's output for a reactive script, which shows the order
+// things are recomputed in, what happens when one fails, and assigning to a
+// variable with a formula
+void check_reactive_script(Tally &t) {
+  const string script = "let a = 1; let b = a * 2; let c = a + b;"
+                        "let d = c * b; a = 3; b; c; d;"
+                        "let x = 1 / (a - 4); let y = x + 1; let z = a + 1;"
+                        "a = 4; x; y; z; b = 10; a = 5; b; c; d; x; y;";
+  const string want = "= 1\n= 2\n= 3\n= 6\n= 3\n= 6\n= 9\n= 54\n"
+                      "= -1\n= 0\n= 4\n"
+                      "= 4\nx keeps its old value: divide by zero\n"
+                      "= -1\n= 0\n= 5\n"
+                      "= 10\n= 5\n= 10\n= 15\n= 150\n= 1\n= 2\n";
+  istringstream in{script};
+  Session s{in};
+  s.reactive = true;
+  ostringstream out;
+  calculate_unprompted(s, out, out);
+  t.expect(out.str() == want, "reactive", "the script wrote\n" + out.str());
+}
+
+// a cache file for a random script, damaged in every way we can think of
+void check_cache(int seed, Tally &t) {
+  using namespace cache_format;
+  Workload w{seed};
+  const string source = w.script(200) + "1/0; let; (1; x = 2; pi = 3;\n";
+  const string path = (filesystem::temp_directory_path() /
+                       ("calc_check_" + to_string(seed) + ".calc"))
+                          .string();
+
+  string want_out, want_err;
+  {
+    istringstream in{source};
+    Session s{in, Token_stream::Mode::block};
+    Script_recording rec;
+    ostringstream os, err;
+    calculate(s, os, err, &rec);
+    if (!rec.save(path, source, s.names))
+      error("can't write ", path);
+    want_out = os.str();
+    want_err = err.str();
+  }
+  ostringstream text;
+  text << ifstream{path, ios_base::binary}.rdbuf();
+  const string good = text.str();
+
+  // write file and load it (and replay it, if that works); should it load
+  auto run = [&](const string &file, const string &what, bool may_load) {
+    ofstream{path, ios_base::binary | ios_base::trunc} << file;
+    Cached_script cs;
+    istringstream none;
+    Session s{none};
+    const bool loaded = cs.load(path, source) && cs.restore(s.names);
+    if (loaded) {
+      ostringstream os, err;
+      replay(cs, s, os, err);
+      if (file == good)
+        t.expect(os.str() == want_out && err.str() == want_err, "cache",
+                 "the replay isn't what calculate() wrote");
+    }
+    t.expect(loaded == may_load || (may_load && file != good), "cache",
+             what + (loaded ? " was loaded" : " wasn't loaded"));
+  };
+
+  run(good, "the file as written", true);
+
+  // where the statements and the instructions are, and the first statement
+  // that compiled
+  const Header &h = *reinterpret_cast<const Header *>(good.data());
+  const size_t at_statements = sizeof(Header) + h.names * sizeof(Name);
+  const size_t at_code = at_statements + h.statements * sizeof(Statement);
+  size_t at_first = at_statements;
+  while (reinterpret_cast<const Statement *>(&good[at_first])->size == 0)
+    at_first += sizeof(Statement);
+  const Statement &first = *reinterpret_cast<const Statement *>(&good[at_first]);
+  const size_t at_op = at_code + first.first * sizeof(Instruction);
+  auto changed = [&](size_t at, const void *p, size_t n) {
+    string f = good;
+    memcpy(&f[at], p, n);
+    return f;
+  };
+
+  run(good.substr(0, good.size() - 1), "a file one byte short", false);
+  run(good.substr(0, sizeof(Header) / 2), "half a header", false);
+  run(good + '\0', "a file with a byte too many", false);
+  run(changed(0, "calcbc\n\1", 8), "a bad magic string", false);
+  const uint32_t huge = 0xFFFFFFF0u;
+  run(changed(offsetof(Header, statements), &huge, sizeof huge),
+      "a huge statement count", false);
+  const Instruction bad_op{Op(0x7F), 0};
+  run(changed(at_op, &bad_op, sizeof bad_op), "an unknown instruction",
+      false);
+  const Instruction far_load{Op::load, int(h.names)};
+  run(changed(at_op, &far_load, sizeof far_load), "a load of no name", false);
+  const Instruction underflow{Op::add, 0};
+  run(changed(at_op, &underflow, sizeof underflow), "a stack underflow",
+      false);
+  const int32_t shallow = 0;
+  run(changed(at_first + offsetof(Statement, max_depth), &shallow,
+              sizeof shallow),
+      "a max_depth too small", false);
+
+  for (int k = 0; k < 200; ++k) {
+    string f = good;
+    for (int n = randint(1, 4); n > 0; --n)
+      f[randint(f.size() - 1)] ^= char(1 << randint(7));
+    run(f, "a file with random bytes changed", true);
+  }
+  remove(path.c_str());
+}
+
+int main(int argc, char *argv[]) {
+  try {
+    int seeds = 40;
+    for (int i = 1; i + 1 < argc; i += 2) {
+      string arg = argv[i];
+      if (arg == "-s")
+        seeds = stoi(argv[i + 1]);
+      else
+        error("unknown option ", arg);
+    }
+
+    Tally check, random, numbers, lexer, ignore, errors, parse, output, jit,
+        kern, batch, parallel, pipeline, mapped, server, reactive, memo, cache;
+    check_checked(check);
+    check_deep(parse);
+    check_errors<double>(errors);
+    check_errors<float>(errors);
+    check_errors<Compensated>(errors);
+    for (int seed = 1; seed <= seeds; ++seed) {
+      check_random(seed, random);
+      check_numbers(seed, numbers);
+      check_lexer(seed, lexer);
+      check_ignore(seed, ignore);
+      check_parse(seed, parse);
+      for (const size_t capacity : {size_t(1), size_t(40), size_t(1) << 16}) {
+        check_output<float>(seed, capacity, output);
+        check_output<double>(seed, capacity, output);
+        check_output<long double>(seed, capacity, output);
+        check_output<Compensated>(seed, capacity, output);
+      }
+      check_jit(seed, jit);
+      check_batch<double>(seed, 600, batch);
+      check_batch<float>(seed, 600, batch);
+      check_batch_output<float>(seed, batch);
+      check_batch_output<double>(seed, batch);
+      check_batch_output<long double>(seed, batch);
+      if (seed % 8 == 1) { // slow: % of awkward values is
+        check_parallel<double>(seed, parallel);
+        check_parallel<float>(seed, parallel);
+      }
+      check_pipeline<double>(seed, pipeline);
+      check_pipeline<Compensated>(seed, pipeline);
+      check_mapped<double>(seed, mapped);
+      check_mapped<long double>(seed, mapped);
+      check_connection(seed, server);
+      check_reactive(seed, reactive);
+      check_memo<double>(seed, memo);
+      check_memo<float>(seed, memo);
+      check_memo<long double>(seed, memo);
+      check_memo<Compensated>(seed, memo);
+      check_cache(seed, cache);
+    }
+    check_reactive_script(reactive);
+    for (int n = 0; n <= 80; ++n) {
+      for (const Kernels_for<double> &k : usable_kernels<double>())
+        check_kernels(k, n, kern);
+      for (const Kernels_for<float> &k : usable_kernels<float>())
+        check_kernels(k, n, kern);
+    }
+    bool ok = check.report("checked");
+    ok &= random.report("random");
+    ok &= numbers.report("numbers");
+    ok &= lexer.report("lexer");
+    ok &= ignore.report("ignore");
+    ok &= errors.report("errors");
+    ok &= parse.report("parse");
+    ok &= output.report("output");
+    ok &= jit.report("jit");
+    ok &= kern.report("kernels");
+    ok &= batch.report("batch");
+    ok &= parallel.report("parallel");
+    ok &= pipeline.report("pipeline");
+    ok &= mapped.report("mapped");
+    ok &= server.report("server");
+    ok &= reactive.report("reactive");
+    ok &= memo.report("memo");
+    ok &= cache.report("cache");
+    return ok ? 0 : 1;
+  } catch (exception &e) {
+    cerr << e.what() << '\n';
+    return 1;
+  }
+}
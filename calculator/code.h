@@ -0,0 +1,203 @@
+/*
+ * code.h
+ *
+ * Compiled form of a calculator Statement.
+ *
+ * The parser (see parser.h) does not compute values as it reads; it emits
+ * instructions for a small stack machine. A Statement compiled once can then
+ * be evaluated any number of times, against whatever values the Symbol_table
+ * holds at the time, without going near the Token_stream again.
+ *
+ * The instructions are in postfix order: "a*(b+1)" becomes
+ *         load a  load b  number 1  add  mul
+ */
+#ifndef CODE_H
+#define CODE_H
+
+#include "../lib/std_lib_facilities.h"
+#include "number.h"
+#include "status.h"
+#include "symbol_table.h"
+
+enum class Op : char {
+  number, // push constants[arg]
+  load,   // push the value of variable arg
+  negate, // -top
+  add,    // next + top
+  sub,    // next - top
+  mul,    // next * top
+  div,    // next / top; error if top is 0
+  mod,    // fmod(next, top); error if top is 0
+  define, // declare variable arg with the value on top (which stays)
+  assign, // give variable arg the value on top (which stays)
+};
+
+struct Instruction {
+  Op op;
+  int arg; // index into constants, or a symbol id
+};
+
+/**
+ * Compiled code stored somewhere other than a Code (in an Arena, say), in
+ * the form try_evaluate() runs. The pointers belong to someone else. The
+ * constants are Ts (see number.h); a Code_view's are doubles.
+ */
+template <class T> struct Basic_code_view {
+  const Instruction *code;
+  int size;
+  const T *constants;
+  int nconstants;
+  int max_depth;
+  long pos;
+};
+
+using Code_view = Basic_code_view<double>;
+
+/**
+ * A compiled Statement: the instructions plus the constants they refer to,
+ * as Ts. max_depth is the deepest the evaluation stack gets, so that
+ * evaluate() can size its stack once instead of checking on every push.
+ * pos is where the Statement started in the input; errors found while
+ * running the code are reported there.
+ */
+template <class T> class Basic_code {
+public:
+  vector<Instruction> code;
+  vector<T> constants;
+  int max_depth{0};
+  long pos{0};
+
+  void emit(Op op, int arg = 0);
+  void emit_number(T d);
+  void clear();
+
+  Basic_code_view<T> view() const {
+    return Basic_code_view<T>{code.data(), int(code.size()),
+                              constants.data(), int(constants.size()),
+                              max_depth, pos};
+  }
+
+private:
+  int depth{0};
+};
+
+using Code = Basic_code<double>;
+
+template <class T> void Basic_code<T>::emit(Op op, int arg) {
+  code.push_back(Instruction{op, arg});
+  switch (op) {
+  case Op::number:
+  case Op::load:
+    if (++depth > max_depth)
+      max_depth = depth;
+    break;
+  case Op::add:
+  case Op::sub:
+  case Op::mul:
+  case Op::div:
+  case Op::mod:
+    --depth;
+    break;
+  case Op::negate:
+  case Op::define:
+  case Op::assign:
+    break;
+  }
+}
+
+template <class T> void Basic_code<T>::emit_number(T d) {
+  constants.push_back(d);
+  emit(Op::number, constants.size() - 1);
+}
+
+template <class T> void Basic_code<T>::clear() {
+  code.clear();
+  constants.clear();
+  max_depth = depth = 0;
+}
+
+// run c on a stack machine, computing with numbers of type T (see
+// number.h); variables are read from (and defined in) st
+template <class T>
+Expected<T> try_evaluate(const Basic_code_view<T> &c,
+                         Basic_symbol_table<T> &st) {
+  constexpr int small = 64;
+  T local[small];
+  vector<T> large;
+  T *stack = local;
+  if (c.max_depth > small) { // only very deeply nested expressions
+    large.resize(c.max_depth);
+    stack = large.data();
+  }
+
+  int sp = 0; // stack[sp-1] is the top
+  for (const Instruction *p = c.code; p != c.code + c.size; ++p) {
+    const Instruction &in = *p;
+    switch (in.op) {
+    case Op::number:
+      stack[sp++] = c.constants[in.arg];
+      break;
+    case Op::load:
+      if (!st.is_declared(in.arg))
+        return Calc_error{Errc::undefined_variable, c.pos, in.arg};
+      stack[sp++] = st.value(in.arg);
+      break;
+    case Op::negate:
+      stack[sp - 1] = -stack[sp - 1];
+      break;
+    case Op::add:
+      --sp;
+      stack[sp - 1] += stack[sp];
+      break;
+    case Op::sub:
+      --sp;
+      stack[sp - 1] -= stack[sp];
+      break;
+    case Op::mul:
+      --sp;
+      stack[sp - 1] *= stack[sp];
+      break;
+    case Op::div:
+      --sp;
+      if (stack[sp] == T(0))
+        return Calc_error{Errc::divide_by_zero, c.pos};
+      stack[sp - 1] /= stack[sp];
+      break;
+    case Op::mod:
+      --sp;
+      if (stack[sp] == T(0))
+        return Calc_error{Errc::mod_by_zero, c.pos};
+      stack[sp - 1] = fmod(stack[sp - 1], stack[sp]);
+      break;
+    case Op::define:
+      if (st.is_declared(in.arg))
+        return Calc_error{Errc::declared_twice, c.pos, in.arg};
+      st.define(in.arg, stack[sp - 1]);
+      break;
+    case Op::assign:
+      if (!st.is_declared(in.arg))
+        return Calc_error{Errc::assign_undefined, c.pos, in.arg};
+      if (st.is_constant(in.arg))
+        return Calc_error{Errc::assign_constant, c.pos, in.arg};
+      st.set(in.arg, stack[sp - 1]);
+      break;
+    }
+  }
+  return stack[sp - 1];
+}
+
+template <class T>
+Expected<T> try_evaluate(const Basic_code<T> &c, Basic_symbol_table<T> &st) {
+  return try_evaluate(c.view(), st);
+}
+
+// run c; throw if that fails
+template <class T>
+T evaluate(const Basic_code<T> &c, Basic_symbol_table<T> &st) {
+  Expected<T> r = try_evaluate(c, st);
+  if (!r)
+    error(message(r.error(), st));
+  return *r;
+}
+
+#endif // CODE_H
@@ -0,0 +1,130 @@
+/*
+ * driver.h
+ *
+ * Running many independent calculations at once: one Session per input
+ * file, on a pool of threads.
+ *
+ * Each file gets its own Session (and so its own Token_stream and
+ * Symbol_table) and writes into its own buffers; nothing is shared between
+ * the threads but the counter that hands out the next file. The results
+ * are written in the order the files were given, each as soon as it and
+ * every file before it are done, so the output is the same as running the
+ * files one after the other.
+ *
+ * With a cache directory, each file's compiled form is kept there (see
+ * script_cache.h), and a file that has been calculated before is replayed
+ * from it instead of being read and compiled again.
+ *
+ * Needs -pthread (or its equivalent) when linking.
+ */
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include "../lib/std_lib_facilities.h"
+#include "calculator.h"
+#include "session.h"
+#include <atomic>
+#include <future>
+#include <thread>
+
+// what calculating one file produced
+struct File_result {
+  string out; // what calculate() (or calculate_unprompted()) wrote
+  string err; // ... and its error messages
+};
+
+// run one file through its own Basic_session of Ts, as o says, using (and
+// filling) the cache directory, if there is one; the cache keeps code of
+// doubles only
+template <class T>
+File_result calculate_file(const string &file, const string &cache = "",
+                           const Run_options &o = {}) {
+  if (!cache.empty() && !is_same_v<T, double>)
+    error("calculate_file: the cache is for double precision only");
+  File_result r;
+  ostringstream os;
+  ostringstream err;
+  ifstream is{file, ios_base::binary};
+  if (!is) {
+    r.err = "can't open " + file + '\n';
+    return r;
+  }
+  if (cache.empty()) {
+    Basic_session<T> s{is, Token_stream::Mode::block};
+    o.apply(s);
+    if (o.prompts)
+      calculate(s, os, err);
+    else
+      calculate_unprompted(s, os, err);
+  } else {
+    ostringstream text;
+    text << is.rdbuf();
+    const string source = text.str();
+    const string path = cache_path(cache, source_hash(source));
+    Cached_script cs;
+    istringstream none;
+    Session replayed{none};
+    o.apply(replayed);
+    if (cs.load(path, source) && cs.restore(replayed.names)) {
+      replay(cs, replayed, os, err, o.prompts);
+    } else {
+      istringstream in{source};
+      Session s{in, Token_stream::Mode::block};
+      o.apply(s);
+      Script_recording rec;
+      if (o.prompts)
+        calculate(s, os, err, &rec);
+      else
+        calculate_unprompted(s, os, err, &rec);
+      rec.save(path, source, s.names);
+    }
+  }
+  r.out = os.str();
+  r.err = err.str();
+  return r;
+}
+
+// calculate every file on (at most) nthreads threads, in Ts, as o says,
+// writing the results to os and err in file order (using the cache
+// directory, if there is one)
+template <class T>
+void calculate_files(const vector<string> &files, int nthreads,
+                     const string &cache = "", const Run_options &o = {},
+                     ostream &os = cout, ostream &err = cerr) {
+  const int n = files.size();
+  if (nthreads <= 0)
+    nthreads = max(1u, thread::hardware_concurrency());
+  nthreads = min(nthreads, n);
+
+  vector<promise<File_result>> results(n);
+  vector<future<File_result>> done;
+  for (promise<File_result> &p : results)
+    done.push_back(p.get_future());
+  atomic<int> next{0};
+  auto work = [&] {
+    for (int i; (i = next++) < n;) {
+      try {
+        results[i].set_value(calculate_file<T>(files[i], cache, o));
+      } catch (...) {
+        results[i].set_exception(current_exception());
+      }
+    }
+  };
+  vector<thread> pool;
+  for (int t = 0; t < nthreads; ++t)
+    pool.emplace_back(work);
+
+  for (int i = 0; i < n; ++i) {
+    try {
+      File_result r = done[i].get();
+      os << r.out;
+      err << r.err;
+    } catch (exception &e) {
+      err << files[i] << ": " << e.what() << '\n';
+    }
+  }
+  for (thread &t : pool)
+    t.join();
+}
+
+#endif // DRIVER_H
@@ -0,0 +1,327 @@
+/*
+ * jit.h
+ *
+ * Compiling Code to machine code, for formulas that are run many times.
+ *
+ * Native_code translates an expression's instructions (see code.h) into an
+ * x86-64 function. The evaluation stack lives in registers: stack slot k
+ * is xmm k, so "a*(b+1)" becomes
+ *         movsd xmm0, a  movsd xmm1, b  movsd xmm2, 1  addsd xmm1, xmm2
+ *         mulsd xmm0, xmm1
+ * The variables are bound by symbol id: the function is handed the
+ * Symbol_table's array of values (see symbol_table.h) and reads variable
+ * id at offset 8*id, so running it copies nothing in, and changes in
+ * values need no telling.
+ *
+ * The results are exactly the interpreter's, errors included:
+ *   - + - * / are the same SSE2 operations try_evaluate() does, one by one,
+ *     and negation flips the sign bit, as -x does
+ *   - a zero divisor (but not a NaN) makes / and % stop with the error at
+ *     the same instruction as try_evaluate() would
+ *   - % is the x87 fprem loop, which computes exactly what fmod() does; for
+ *     a NaN operand it gives fmod()'s NaN (the first one), sign and payload
+ *   - code that uses a variable that isn't declared is not compiled, so the
+ *     interpreter gives the error, at the point it gives it; a declared
+ *     variable stays declared, so what is compiled needs no checks
+ * Code that can't be translated (declarations, assignments, stacks deeper
+ * than the registers, undeclared variables) is simply not compiled; run()
+ * then interprets it.
+ *
+ * Only x86-64 with mmap() (for executable memory) gets native code; there
+ * is no AArch64 back end yet, and everywhere else compile() says no and
+ * everything is interpreted. Define CALC_NO_JIT to leave the JIT out.
+ */
+#ifndef JIT_H
+#define JIT_H
+
+#include "../lib/std_lib_facilities.h"
+#include "code.h"
+#include "status.h"
+#include "symbol_table.h"
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__)) &&      \
+    !defined(CALC_NO_JIT)
+#define CALC_JIT 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Executable memory for native code. Functions are copied in one after the
+ * other; a page is writable only while code is being copied into it, never
+ * while it can run. Everything goes when the Jit_memory does.
+ */
+class Jit_memory {
+public:
+  Jit_memory() = default;
+  ~Jit_memory();
+
+  Jit_memory(const Jit_memory &) = delete;
+  Jit_memory &operator=(const Jit_memory &) = delete;
+
+  // a copy of code that can be called; nullptr if there can't be one
+  const void *install(const vector<uint8_t> &code);
+
+private:
+  static constexpr size_t chunk_size = 64 * 1024;
+  struct Chunk {
+    uint8_t *base;
+    size_t size;
+  };
+  vector<Chunk> chunks;
+  size_t used{0}; // of chunks.back()
+};
+
+#ifdef CALC_JIT
+
+inline Jit_memory::~Jit_memory() {
+  for (const Chunk &c : chunks)
+    munmap(c.base, c.size);
+}
+
+inline const void *Jit_memory::install(const vector<uint8_t> &code) {
+  const size_t n = (code.size() + 15) & ~size_t(15);
+  if (chunks.empty() || chunks.back().size - used < n) {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t size = max(chunk_size, (n + page - 1) / page * page);
+    void *p = mmap(nullptr, size, PROT_READ | PROT_EXEC,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      return nullptr;
+    chunks.push_back(Chunk{static_cast<uint8_t *>(p), size});
+    used = 0;
+  }
+  Chunk &c = chunks.back();
+  uint8_t *f = c.base + used;
+  // just the pages f is on
+  const size_t page = sysconf(_SC_PAGESIZE);
+  uint8_t *first = c.base + used / page * page;
+  const size_t span = (used + code.size() + page - 1) / page * page -
+                      (first - c.base);
+  if (mprotect(first, span, PROT_READ | PROT_WRITE) != 0)
+    return nullptr;
+  memcpy(f, code.data(), code.size());
+  if (mprotect(first, span, PROT_READ | PROT_EXEC) != 0)
+    return nullptr;
+  used += n;
+  return f;
+}
+
+#else
+
+inline Jit_memory::~Jit_memory() {}
+inline const void *Jit_memory::install(const vector<uint8_t> &) {
+  return nullptr;
+}
+
+#endif // CALC_JIT
+
+/**
+ * An expression compiled to machine code (or not: then run() interprets).
+ */
+class Native_code {
+public:
+  // translate c, to run against st, into m; false if it can't be (run()
+  // then interprets c)
+  bool compile(const Code_view &c, const Symbol_table &st, Jit_memory &m);
+  bool is_native() const { return fn != nullptr; }
+
+  // run c, natively if it was compiled; the same results as try_evaluate().
+  // st is the table it was compiled against
+  Expected<double> run(const Code_view &c, Symbol_table &st) const;
+
+private:
+  // values: by symbol id; returns 0, or which error stopped it
+  using Function = int (*)(const double *values, const double *constants,
+                           double *result);
+  enum Failure { ok, divide_by_zero, mod_by_zero };
+  static constexpr int registers = 14; // xmm0-13; xmm14-15 are scratch
+  static constexpr int max_id = numeric_limits<int32_t>::max() / 8;
+
+  Function fn{nullptr};
+};
+
+// x86-64 machine code, an instruction at a time
+class X86_emitter {
+public:
+  vector<uint8_t> code;
+
+  void bytes(std::initializer_list<uint8_t> bs) {
+    code.insert(code.end(), bs.begin(), bs.end());
+  }
+  void imm32(int32_t v) {
+    for (int i = 0; i < 4; ++i)
+      code.push_back(uint8_t(v >> (8 * i)));
+  }
+
+  // prefix [REX] 0F op ModRM: reg is an xmm, rm an xmm (mod 3) or a base
+  // register; wide sets REX.W
+  void sse(uint8_t prefix, uint8_t op, int reg, int rm, int mod,
+           bool wide = false) {
+    code.push_back(prefix);
+    const uint8_t rex =
+        0x40 | (wide ? 8 : 0) | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0);
+    if (rex != 0x40)
+      code.push_back(rex);
+    bytes({0x0F, op, uint8_t(mod << 6 | (reg & 7) << 3 | (rm & 7))});
+  }
+
+  // movsd xmm, [base + disp32]; base is rdi or rsi, which need no SIB
+  void load(int xmm, int base, int32_t disp) {
+    sse(0xF2, 0x10, xmm, base, 2);
+    imm32(disp);
+  }
+  // movsd [rsp + disp], xmm and back: the red zone, below rsp
+  void spill(int xmm, int8_t disp) {
+    sse(0xF2, 0x11, xmm, 4, 1);
+    bytes({0x24, uint8_t(disp)});
+  }
+  void unspill(int xmm, int8_t disp) {
+    sse(0xF2, 0x10, xmm, 4, 1);
+    bytes({0x24, uint8_t(disp)});
+  }
+  // addsd (58), mulsd (59), subsd (5C), divsd (5E) dst, src
+  void arith(uint8_t op, int dst, int src) { sse(0xF2, op, dst, src, 3); }
+
+  // flip the sign bit, as -x does
+  void negate(int xmm) {
+    sse(0x66, 0x7E, xmm, 0, 3, true);     // movq rax, xmm
+    bytes({0x48, 0x0F, 0xBA, 0xF8, 0x3F}); // btc rax, 63
+    sse(0x66, 0x6E, xmm, 0, 3, true);     // movq xmm, rax
+  }
+
+  // fmod(a, b) into a, exactly: fprem until the remainder is complete. A
+  // NaN operand is passed on as fmod() passes it (the first NaN of a, b),
+  // not as fprem would
+  void remainder(int a, int b) {
+    sse(0x66, 0x2E, a, b, 3); // ucomisd a, b
+    bytes({0x7A, 0});         // jp nan: unordered, so a or b is a NaN
+    const size_t nan = code.size();
+    spill(a, -8);
+    spill(b, -16);
+    bytes({0xDD, 0x44, 0x24, 0xF0}); // fld qword [rsp-16]  (b)
+    bytes({0xDD, 0x44, 0x24, 0xF8}); // fld qword [rsp-8]   (a)
+    bytes({0xD9, 0xF8,               // again: fprem
+           0xDF, 0xE0,               // fnstsw ax
+           0xF6, 0xC4, 0x04,         // test ah, 4 (C2: not done yet)
+           0x75, 0xF7});             // jnz again
+    bytes({0xDD, 0x5C, 0x24, 0xF8}); // fstp qword [rsp-8]
+    bytes({0xDD, 0xD8});             // fstp st(0)
+    unspill(a, -8);
+    bytes({0xEB, 0}); // jmp done
+    const size_t done = code.size();
+    code[nan - 1] = uint8_t(done - nan);
+    arith(0x59, a, b); // nan: mulsd a, b gives a if it is a NaN, else b
+    code[done - 1] = uint8_t(code.size() - done);
+  }
+
+  // jump to a failure exit if xmm is zero (a NaN isn't); the jump is
+  // patched once the exit's place is known
+  void jump_if_zero(int xmm, vector<size_t> &fixups) {
+    sse(0x66, 0x2E, xmm, 15, 3); // ucomisd xmm, xmm15 (which holds 0.0)
+    bytes({0x7A, 0x06});         // jp over the je: unordered, so not 0
+    bytes({0x0F, 0x84});         // je rel32
+    fixups.push_back(code.size());
+    imm32(0);
+  }
+  void patch(const vector<size_t> &fixups) {
+    for (size_t at : fixups) {
+      const int32_t rel = int32_t(code.size() - (at + 4));
+      memcpy(&code[at], &rel, 4);
+    }
+  }
+};
+
+inline bool Native_code::compile(const Code_view &c, const Symbol_table &st,
+                                 Jit_memory &m) {
+  fn = nullptr;
+#ifndef CALC_JIT
+  (void)c;
+  (void)st;
+  (void)m;
+  return false;
+#else
+  if (c.max_depth > registers)
+    return false;
+  const int rdi = 7; // values
+  const int rsi = 6; // constants
+  X86_emitter x;
+  vector<size_t> div_fail;
+  vector<size_t> mod_fail;
+  x.sse(0x66, 0x57, 15, 15, 3); // xorpd xmm15, xmm15
+
+  int sp = 0; // xmm sp-1 is the top
+  for (const Instruction *in = c.code; in != c.code + c.size; ++in) {
+    switch (in->op) {
+    case Op::number:
+      x.load(sp++, rsi, 8 * in->arg);
+      break;
+    case Op::load:
+      if (!st.is_declared(in->arg) || in->arg > max_id)
+        return false;
+      x.load(sp++, rdi, 8 * in->arg);
+      break;
+    case Op::negate:
+      x.negate(sp - 1);
+      break;
+    case Op::add:
+      --sp;
+      x.arith(0x58, sp - 1, sp);
+      break;
+    case Op::sub:
+      --sp;
+      x.arith(0x5C, sp - 1, sp);
+      break;
+    case Op::mul:
+      --sp;
+      x.arith(0x59, sp - 1, sp);
+      break;
+    case Op::div:
+      --sp;
+      x.jump_if_zero(sp, div_fail);
+      x.arith(0x5E, sp - 1, sp);
+      break;
+    case Op::mod:
+      --sp;
+      x.jump_if_zero(sp, mod_fail);
+      x.remainder(sp - 1, sp);
+      break;
+    default: // define, assign: leave those to the interpreter
+      return false;
+    }
+  }
+
+  x.sse(0xF2, 0x11, 0, 2, 0); // movsd [rdx], xmm0
+  x.bytes({0x31, 0xC0, 0xC3}); // xor eax, eax; ret
+  x.patch(div_fail);
+  x.bytes({0xB8});             // mov eax, divide_by_zero; ret
+  x.imm32(divide_by_zero);
+  x.bytes({0xC3});
+  x.patch(mod_fail);
+  x.bytes({0xB8});             // mov eax, mod_by_zero; ret
+  x.imm32(mod_by_zero);
+  x.bytes({0xC3});
+
+  fn = reinterpret_cast<Function>(const_cast<void *>(m.install(x.code)));
+  return fn != nullptr;
+#endif // CALC_JIT
+}
+
+inline Expected<double> Native_code::run(const Code_view &c,
+                                         Symbol_table &st) const {
+  if (!fn)
+    return try_evaluate(c, st);
+  double r;
+  switch (fn(st.value_array(), c.constants, &r)) {
+  case ok:
+    return r;
+  case divide_by_zero:
+    return Calc_error{Errc::divide_by_zero, c.pos};
+  default:
+    return Calc_error{Errc::mod_by_zero, c.pos};
+  }
+}
+
+#endif // JIT_H
@@ -0,0 +1,487 @@
+/*
+ * kernels.h
+ *
+ * The arithmetic of batch evaluation: each operator applied to a block of
+ * values at once.
+ *
+ * There is a plain version of every kernel, and versions written with the
+ * vector instructions of AVX2, AVX-512 and NEON. kernels() finds out once,
+ * at run time, which of those the CPU we are running on has, and hands out
+ * the best set; a binary built for a plain x86-64 still uses AVX-512 on a
+ * machine that has it.
+ *
+ * The kernels are for doubles and for floats (where a vector holds twice
+ * as many values); the plain ones are templates, which serve any other
+ * type of number (see number.h) too.
+ *
+ * fmod() has no vector instruction. The vector mod kernels compute
+ *         r = a - trunc(a/b)*b
+ * with a fused multiply-add, which is exact whenever trunc(a/b) is the
+ * true quotient, and they can tell when it is: exactly then r is 0 or has
+ * the sign of a, and |r| < |b|. The (rare) lanes that fail that test,
+ * including infinities and NaNs, are redone with fmod(), so every kernel
+ * gives the same results as the plain loop, bit for bit.
+ */
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "../lib/std_lib_facilities.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+template <class T> struct Kernels_for {
+  const char *name;
+  bool (*any_zero)(const T *b, int n); // is some b[i] == 0
+  void (*add)(T *dst, const T *a, const T *b, int n);
+  void (*sub)(T *dst, const T *a, const T *b, int n);
+  void (*mul)(T *dst, const T *a, const T *b, int n);
+  void (*div)(T *dst, const T *a, const T *b, int n);
+  void (*mod)(T *dst, const T *a, const T *b, int n);
+};
+
+using Kernels = Kernels_for<double>;
+
+// the plain versions; also used for the ends of blocks by the others
+
+template <class T> bool any_zero_plain(const T *b, int n) {
+  bool zero = false;
+  for (int i = 0; i < n; ++i)
+    zero |= b[i] == T(0);
+  return zero;
+}
+
+template <class T> void add_plain(T *dst, const T *a, const T *b, int n) {
+  for (int i = 0; i < n; ++i)
+    dst[i] = a[i] + b[i];
+}
+
+template <class T> void sub_plain(T *dst, const T *a, const T *b, int n) {
+  for (int i = 0; i < n; ++i)
+    dst[i] = a[i] - b[i];
+}
+
+template <class T> void mul_plain(T *dst, const T *a, const T *b, int n) {
+  for (int i = 0; i < n; ++i)
+    dst[i] = a[i] * b[i];
+}
+
+template <class T> void div_plain(T *dst, const T *a, const T *b, int n) {
+  for (int i = 0; i < n; ++i)
+    dst[i] = a[i] / b[i];
+}
+
+template <class T> void mod_plain(T *dst, const T *a, const T *b, int n) {
+  for (int i = 0; i < n; ++i)
+    dst[i] = fmod(a[i], b[i]);
+}
+
+// redo the lanes of a vector mod whose bits in bad are set, in two steps,
+// since dst may be a (as it is in batch.h): the lanes are redone into
+// fixed before the vector's results are stored over a, and put in place
+// after
+template <class T>
+void mod_redo(T *fixed, const T *a, const T *b, unsigned bad) {
+  for (int k = 0; bad; ++k, bad >>= 1)
+    if (bad & 1)
+      fixed[k] = fmod(a[k], b[k]);
+}
+template <class T> void mod_patch(T *dst, const T *fixed, unsigned bad) {
+  for (int k = 0; bad; ++k, bad >>= 1)
+    if (bad & 1)
+      dst[k] = fixed[k];
+}
+
+#ifdef KERNELS_X86
+
+#define KERNELS_AVX2 __attribute__((target("avx2,fma")))
+#define KERNELS_AVX512 __attribute__((target("avx512f")))
+
+// x + y or x * y with x as the first operand, so that when both are NaNs
+// the result is x's, as in scalar code: the intrinsics don't promise it,
+// since the compiler may swap the operands of an operation that commutes
+#define KERNELS_ORDERED(target, name, type, instruction)                       \
+  target inline type name(type x, type y) {                                    \
+    type r;                                                                    \
+    asm(instruction " %2, %1, %0" : "=v"(r) : "v"(x), "v"(y));                 \
+    return r;                                                                  \
+  }
+
+KERNELS_ORDERED(KERNELS_AVX2, add_ordered, __m256d, "vaddpd")
+KERNELS_ORDERED(KERNELS_AVX2, mul_ordered, __m256d, "vmulpd")
+KERNELS_ORDERED(KERNELS_AVX512, add_ordered, __m512d, "vaddpd")
+KERNELS_ORDERED(KERNELS_AVX512, mul_ordered, __m512d, "vmulpd")
+KERNELS_ORDERED(KERNELS_AVX2, add_ordered, __m256, "vaddps")
+KERNELS_ORDERED(KERNELS_AVX2, mul_ordered, __m256, "vmulps")
+KERNELS_ORDERED(KERNELS_AVX512, add_ordered, __m512, "vaddps")
+KERNELS_ORDERED(KERNELS_AVX512, mul_ordered, __m512, "vmulps")
+
+KERNELS_AVX2 inline bool any_zero_avx2(const double *b, int n) {
+  const __m256d zero = _mm256_setzero_pd();
+  __m256d m = zero;
+  int i = 0;
+  for (; i + 4 <= n; i += 4)
+    m = _mm256_or_pd(m, _mm256_cmp_pd(_mm256_loadu_pd(b + i), zero,
+                                      _CMP_EQ_OQ));
+  return _mm256_movemask_pd(m) != 0 || any_zero_plain(b + i, n - i);
+}
+
+#define KERNELS_AVX2_BINARY(op, intrinsic)                                     \
+  KERNELS_AVX2 inline void op##_avx2(double *dst, const double *a,            \
+                                     const double *b, int n) {                \
+    int i = 0;                                                                 \
+    for (; i + 4 <= n; i += 4)                                                 \
+      _mm256_storeu_pd(dst + i, intrinsic(_mm256_loadu_pd(a + i),              \
+                                          _mm256_loadu_pd(b + i)));            \
+    op##_plain(dst + i, a + i, b + i, n - i);                                  \
+  }
+
+KERNELS_AVX2_BINARY(add, add_ordered)
+KERNELS_AVX2_BINARY(sub, _mm256_sub_pd)
+KERNELS_AVX2_BINARY(mul, mul_ordered)
+KERNELS_AVX2_BINARY(div, _mm256_div_pd)
+
+KERNELS_AVX2 inline void mod_avx2(double *dst, const double *a,
+                                  const double *b, int n) {
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  const __m256d zero = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256d x = _mm256_loadu_pd(a + i);
+    const __m256d y = _mm256_loadu_pd(b + i);
+    const __m256d q = _mm256_round_pd(_mm256_div_pd(x, y),
+                                      _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    const __m256d r = _mm256_fnmadd_pd(q, y, x);
+    const __m256d ar = _mm256_andnot_pd(sign, r);
+    const int small =
+        _mm256_movemask_pd(_mm256_cmp_pd(ar, _mm256_andnot_pd(sign, y),
+                                         _CMP_LT_OQ));
+    const int is_zero = _mm256_movemask_pd(_mm256_cmp_pd(r, zero, _CMP_EQ_OQ));
+    const int flipped = _mm256_movemask_pd(_mm256_xor_pd(r, x));
+    const unsigned bad = ~(small & (~flipped | is_zero)) & 0xf;
+    double fixed[4];
+    if (bad)
+      mod_redo(fixed, a + i, b + i, bad);
+    // copysign(r, x): fmod() keeps the sign of a, even for a zero result
+    _mm256_storeu_pd(dst + i, _mm256_or_pd(ar, _mm256_and_pd(sign, x)));
+    if (bad)
+      mod_patch(dst + i, fixed, bad);
+  }
+  mod_plain(dst + i, a + i, b + i, n - i);
+}
+
+// the same for floats, eight to a vector
+
+KERNELS_AVX2 inline bool any_zero_avx2(const float *b, int n) {
+  const __m256 zero = _mm256_setzero_ps();
+  __m256 m = zero;
+  int i = 0;
+  for (; i + 8 <= n; i += 8)
+    m = _mm256_or_ps(m, _mm256_cmp_ps(_mm256_loadu_ps(b + i), zero,
+                                      _CMP_EQ_OQ));
+  return _mm256_movemask_ps(m) != 0 || any_zero_plain(b + i, n - i);
+}
+
+#define KERNELS_AVX2_BINARY_PS(op, intrinsic)                                  \
+  KERNELS_AVX2 inline void op##_avx2(float *dst, const float *a,              \
+                                     const float *b, int n) {                 \
+    int i = 0;                                                                 \
+    for (; i + 8 <= n; i += 8)                                                 \
+      _mm256_storeu_ps(dst + i, intrinsic(_mm256_loadu_ps(a + i),              \
+                                          _mm256_loadu_ps(b + i)));            \
+    op##_plain(dst + i, a + i, b + i, n - i);                                  \
+  }
+
+KERNELS_AVX2_BINARY_PS(add, add_ordered)
+KERNELS_AVX2_BINARY_PS(sub, _mm256_sub_ps)
+KERNELS_AVX2_BINARY_PS(mul, mul_ordered)
+KERNELS_AVX2_BINARY_PS(div, _mm256_div_ps)
+
+KERNELS_AVX2 inline void mod_avx2(float *dst, const float *a, const float *b,
+                                  int n) {
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  const __m256 zero = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 x = _mm256_loadu_ps(a + i);
+    const __m256 y = _mm256_loadu_ps(b + i);
+    const __m256 q = _mm256_round_ps(_mm256_div_ps(x, y),
+                                     _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    const __m256 r = _mm256_fnmadd_ps(q, y, x);
+    const __m256 ar = _mm256_andnot_ps(sign, r);
+    const int small =
+        _mm256_movemask_ps(_mm256_cmp_ps(ar, _mm256_andnot_ps(sign, y),
+                                         _CMP_LT_OQ));
+    const int is_zero = _mm256_movemask_ps(_mm256_cmp_ps(r, zero, _CMP_EQ_OQ));
+    const int flipped = _mm256_movemask_ps(_mm256_xor_ps(r, x));
+    const unsigned bad = ~(small & (~flipped | is_zero)) & 0xff;
+    float fixed[8];
+    if (bad)
+      mod_redo(fixed, a + i, b + i, bad);
+    _mm256_storeu_ps(dst + i, _mm256_or_ps(ar, _mm256_and_ps(sign, x)));
+    if (bad)
+      mod_patch(dst + i, fixed, bad);
+  }
+  mod_plain(dst + i, a + i, b + i, n - i);
+}
+
+KERNELS_AVX512 inline bool any_zero_avx512(const double *b, int n) {
+  const __m512d zero = _mm512_setzero_pd();
+  __mmask8 m = 0;
+  int i = 0;
+  for (; i + 8 <= n; i += 8)
+    m |= _mm512_cmp_pd_mask(_mm512_loadu_pd(b + i), zero, _CMP_EQ_OQ);
+  return m != 0 || any_zero_plain(b + i, n - i);
+}
+
+#define KERNELS_AVX512_BINARY(op, intrinsic)                                   \
+  KERNELS_AVX512 inline void op##_avx512(double *dst, const double *a,        \
+                                         const double *b, int n) {            \
+    int i = 0;                                                                 \
+    for (; i + 8 <= n; i += 8)                                                 \
+      _mm512_storeu_pd(dst + i, intrinsic(_mm512_loadu_pd(a + i),              \
+                                          _mm512_loadu_pd(b + i)));            \
+    op##_plain(dst + i, a + i, b + i, n - i);                                  \
+  }
+
+KERNELS_AVX512_BINARY(add, add_ordered)
+KERNELS_AVX512_BINARY(sub, _mm512_sub_pd)
+KERNELS_AVX512_BINARY(mul, mul_ordered)
+KERNELS_AVX512_BINARY(div, _mm512_div_pd)
+
+KERNELS_AVX512 inline void mod_avx512(double *dst, const double *a,
+                                      const double *b, int n) {
+  const __m512i sign = _mm512_set1_epi64(0x8000000000000000LL);
+  const __m512i magnitude = _mm512_set1_epi64(0x7fffffffffffffffLL);
+  const __m512d zero = _mm512_setzero_pd();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m512d x = _mm512_loadu_pd(a + i);
+    const __m512d y = _mm512_loadu_pd(b + i);
+    const __m512d q = _mm512_maskz_roundscale_pd(
+        0xff, _mm512_div_pd(x, y), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    const __m512d r = _mm512_fnmadd_pd(q, y, x);
+    const __m512i ri = _mm512_castpd_si512(r);
+    const __m512i xi = _mm512_castpd_si512(x);
+    const __m512i ar = _mm512_and_si512(ri, magnitude);
+    const __m512i ay = _mm512_and_si512(_mm512_castpd_si512(y), magnitude);
+    const __mmask8 small = _mm512_cmp_pd_mask(
+        _mm512_castsi512_pd(ar), _mm512_castsi512_pd(ay), _CMP_LT_OQ);
+    const __mmask8 is_zero = _mm512_cmp_pd_mask(r, zero, _CMP_EQ_OQ);
+    const __mmask8 flipped =
+        _mm512_test_epi64_mask(_mm512_xor_si512(ri, xi), sign);
+    const unsigned bad = ~(small & (~flipped | is_zero)) & 0xff;
+    double fixed[8];
+    if (bad)
+      mod_redo(fixed, a + i, b + i, bad);
+    _mm512_storeu_pd(dst + i, _mm512_castsi512_pd(_mm512_or_si512(
+                                  ar, _mm512_and_si512(sign, xi))));
+    if (bad)
+      mod_patch(dst + i, fixed, bad);
+  }
+  mod_plain(dst + i, a + i, b + i, n - i);
+}
+
+// the same for floats, sixteen to a vector
+
+KERNELS_AVX512 inline bool any_zero_avx512(const float *b, int n) {
+  const __m512 zero = _mm512_setzero_ps();
+  __mmask16 m = 0;
+  int i = 0;
+  for (; i + 16 <= n; i += 16)
+    m |= _mm512_cmp_ps_mask(_mm512_loadu_ps(b + i), zero, _CMP_EQ_OQ);
+  return m != 0 || any_zero_plain(b + i, n - i);
+}
+
+#define KERNELS_AVX512_BINARY_PS(op, intrinsic)                                \
+  KERNELS_AVX512 inline void op##_avx512(float *dst, const float *a,          \
+                                         const float *b, int n) {             \
+    int i = 0;                                                                 \
+    for (; i + 16 <= n; i += 16)                                               \
+      _mm512_storeu_ps(dst + i, intrinsic(_mm512_loadu_ps(a + i),              \
+                                          _mm512_loadu_ps(b + i)));            \
+    op##_plain(dst + i, a + i, b + i, n - i);                                  \
+  }
+
+KERNELS_AVX512_BINARY_PS(add, add_ordered)
+KERNELS_AVX512_BINARY_PS(sub, _mm512_sub_ps)
+KERNELS_AVX512_BINARY_PS(mul, mul_ordered)
+KERNELS_AVX512_BINARY_PS(div, _mm512_div_ps)
+
+KERNELS_AVX512 inline void mod_avx512(float *dst, const float *a,
+                                      const float *b, int n) {
+  const __m512i sign = _mm512_castps_si512(_mm512_set1_ps(-0.0f));
+  const __m512i magnitude = _mm512_set1_epi32(0x7fffffff);
+  const __m512 zero = _mm512_setzero_ps();
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m512 x = _mm512_loadu_ps(a + i);
+    const __m512 y = _mm512_loadu_ps(b + i);
+    const __m512 q = _mm512_maskz_roundscale_ps(
+        0xffff, _mm512_div_ps(x, y), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    const __m512 r = _mm512_fnmadd_ps(q, y, x);
+    const __m512i ri = _mm512_castps_si512(r);
+    const __m512i xi = _mm512_castps_si512(x);
+    const __m512i ar = _mm512_and_si512(ri, magnitude);
+    const __m512i ay = _mm512_and_si512(_mm512_castps_si512(y), magnitude);
+    const __mmask16 small = _mm512_cmp_ps_mask(
+        _mm512_castsi512_ps(ar), _mm512_castsi512_ps(ay), _CMP_LT_OQ);
+    const __mmask16 is_zero = _mm512_cmp_ps_mask(r, zero, _CMP_EQ_OQ);
+    const __mmask16 flipped =
+        _mm512_test_epi32_mask(_mm512_xor_si512(ri, xi), sign);
+    const unsigned bad = ~(small & (~flipped | is_zero)) & 0xffff;
+    float fixed[16];
+    if (bad)
+      mod_redo(fixed, a + i, b + i, bad);
+    _mm512_storeu_ps(dst + i, _mm512_castsi512_ps(_mm512_or_si512(
+                                  ar, _mm512_and_si512(sign, xi))));
+    if (bad)
+      mod_patch(dst + i, fixed, bad);
+  }
+  mod_plain(dst + i, a + i, b + i, n - i);
+}
+
+#endif // KERNELS_X86
+
+#ifdef KERNELS_NEON
+
+inline bool any_zero_neon(const double *b, int n) {
+  uint64x2_t m = vdupq_n_u64(0);
+  int i = 0;
+  for (; i + 2 <= n; i += 2)
+    m = vorrq_u64(m, vceqzq_f64(vld1q_f64(b + i)));
+  return vmaxvq_u32(vreinterpretq_u32_u64(m)) != 0 ||
+         any_zero_plain(b + i, n - i);
+}
+
+#define KERNELS_NEON_BINARY(op, intrinsic)                                     \
+  inline void op##_neon(double *dst, const double *a, const double *b,        \
+                        int n) {                                               \
+    int i = 0;                                                                 \
+    for (; i + 2 <= n; i += 2)                                                 \
+      vst1q_f64(dst + i, intrinsic(vld1q_f64(a + i), vld1q_f64(b + i)));      \
+    op##_plain(dst + i, a + i, b + i, n - i);                                  \
+  }
+
+KERNELS_NEON_BINARY(add, vaddq_f64)
+KERNELS_NEON_BINARY(sub, vsubq_f64)
+KERNELS_NEON_BINARY(mul, vmulq_f64)
+KERNELS_NEON_BINARY(div, vdivq_f64)
+
+inline void mod_neon(double *dst, const double *a, const double *b, int n) {
+  const uint64x2_t sign = vdupq_n_u64(0x8000000000000000ULL);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    const float64x2_t x = vld1q_f64(a + i);
+    const float64x2_t y = vld1q_f64(b + i);
+    const float64x2_t q = vrndq_f64(vdivq_f64(x, y)); // toward zero
+    const float64x2_t r = vfmsq_f64(x, q, y);         // x - q*y, fused
+    const uint64x2_t ri = vreinterpretq_u64_f64(r);
+    const uint64x2_t xi = vreinterpretq_u64_f64(x);
+    const uint64x2_t small = vcaltq_f64(r, y); // |r| < |y|
+    const uint64x2_t same = vceqzq_u64(vandq_u64(veorq_u64(ri, xi), sign));
+    const uint64x2_t ok = vandq_u64(small, vorrq_u64(same, vceqzq_f64(r)));
+    const unsigned bad =
+        (vgetq_lane_u64(ok, 0) ? 0 : 1) | (vgetq_lane_u64(ok, 1) ? 0 : 2);
+    double fixed[2];
+    if (bad)
+      mod_redo(fixed, a + i, b + i, bad);
+    vst1q_f64(dst + i, vreinterpretq_f64_u64(vorrq_u64(
+                           vbicq_u64(ri, sign), vandq_u64(xi, sign))));
+    if (bad)
+      mod_patch(dst + i, fixed, bad);
+  }
+  mod_plain(dst + i, a + i, b + i, n - i);
+}
+
+// the same for floats, four to a vector
+
+inline bool any_zero_neon(const float *b, int n) {
+  uint32x4_t m = vdupq_n_u32(0);
+  int i = 0;
+  for (; i + 4 <= n; i += 4)
+    m = vorrq_u32(m, vceqzq_f32(vld1q_f32(b + i)));
+  return vmaxvq_u32(m) != 0 || any_zero_plain(b + i, n - i);
+}
+
+#define KERNELS_NEON_BINARY_PS(op, intrinsic)                                  \
+  inline void op##_neon(float *dst, const float *a, const float *b, int n) {  \
+    int i = 0;                                                                 \
+    for (; i + 4 <= n; i += 4)                                                 \
+      vst1q_f32(dst + i, intrinsic(vld1q_f32(a + i), vld1q_f32(b + i)));      \
+    op##_plain(dst + i, a + i, b + i, n - i);                                  \
+  }
+
+KERNELS_NEON_BINARY_PS(add, vaddq_f32)
+KERNELS_NEON_BINARY_PS(sub, vsubq_f32)
+KERNELS_NEON_BINARY_PS(mul, vmulq_f32)
+KERNELS_NEON_BINARY_PS(div, vdivq_f32)
+
+inline void mod_neon(float *dst, const float *a, const float *b, int n) {
+  const uint32x4_t sign = vdupq_n_u32(0x80000000u);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const float32x4_t x = vld1q_f32(a + i);
+    const float32x4_t y = vld1q_f32(b + i);
+    const float32x4_t q = vrndq_f32(vdivq_f32(x, y)); // toward zero
+    const float32x4_t r = vfmsq_f32(x, q, y);         // x - q*y, fused
+    const uint32x4_t ri = vreinterpretq_u32_f32(r);
+    const uint32x4_t xi = vreinterpretq_u32_f32(x);
+    const uint32x4_t small = vcaltq_f32(r, y); // |r| < |y|
+    const uint32x4_t same = vceqzq_u32(vandq_u32(veorq_u32(ri, xi), sign));
+    const uint32x4_t ok = vandq_u32(small, vorrq_u32(same, vceqzq_f32(r)));
+    const unsigned bad =
+        (vgetq_lane_u32(ok, 0) ? 0 : 1) | (vgetq_lane_u32(ok, 1) ? 0 : 2) |
+        (vgetq_lane_u32(ok, 2) ? 0 : 4) | (vgetq_lane_u32(ok, 3) ? 0 : 8);
+    float fixed[4];
+    if (bad)
+      mod_redo(fixed, a + i, b + i, bad);
+    vst1q_f32(dst + i, vreinterpretq_f32_u32(vorrq_u32(
+                           vbicq_u32(ri, sign), vandq_u32(xi, sign))));
+    if (bad)
+      mod_patch(dst + i, fixed, bad);
+  }
+  mod_plain(dst + i, a + i, b + i, n - i);
+}
+
+#endif // KERNELS_NEON
+
+// every set of kernels for numbers of type T this CPU can run, best first
+// (there are vector kernels for double and float only; the plain ones are
+// always there, last)
+template <class T> vector<Kernels_for<T>> usable_kernels() {
+  using K = Kernels_for<T>;
+  vector<K> ks;
+  if constexpr (is_same_v<T, double> || is_same_v<T, float>) {
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+      ks.push_back(K{"avx512",   any_zero_avx512, add_avx512, sub_avx512,
+                     mul_avx512, div_avx512,      mod_avx512});
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      ks.push_back(K{"avx2",   any_zero_avx2, add_avx2, sub_avx2,
+                     mul_avx2, div_avx2,      mod_avx2});
+#endif
+#ifdef KERNELS_NEON
+    ks.push_back(K{"neon",   any_zero_neon, add_neon, sub_neon,
+                   mul_neon, div_neon,      mod_neon});
+#endif
+  }
+  ks.push_back(K{"plain",      any_zero_plain<T>, add_plain<T>, sub_plain<T>,
+                 mul_plain<T>, div_plain<T>,      mod_plain<T>});
+  return ks;
+}
+
+// the best kernels for this CPU, for numbers of type T; decided on first
+// use
+template <class T = double> const Kernels_for<T> &kernels() {
+  static const Kernels_for<T> k = usable_kernels<T>().front();
+  return k;
+}
+
+#endif // KERNELS_H
@@ -0,0 +1,100 @@
+/*
+ * mapped_file.h
+ *
+ * A file's contents in memory, read-only, without reading it: where there
+ * is mmap(), the file is mapped and the pages are read in as they are
+ * first touched. Where there isn't, the file is read into a buffer.
+ *
+ * A file read from start to end (a script) should say so: the kernel then
+ * reads ahead aggressively and drops the pages behind the reader, so even
+ * a file larger than memory streams through at disk speed.
+ */
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include "../lib/std_lib_facilities.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CALC_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * The contents of a file, read-only: mapped where that's possible, read
+ * into memory where it isn't. The file is empty() if it can't be read.
+ */
+class Mapped_file {
+public:
+  enum class Access { random, sequential };
+
+  explicit Mapped_file(const string &path, Access a = Access::random);
+  ~Mapped_file();
+
+  Mapped_file(const Mapped_file &) = delete;
+  Mapped_file &operator=(const Mapped_file &) = delete;
+
+  const char *data() const { return addr; }
+  size_t size() const { return len; }
+  bool empty() const { return len == 0; }
+  bool is_open() const { return opened; } // (an empty file is open)
+
+private:
+  const char *addr{nullptr};
+  size_t len{0};
+  bool opened{false};
+#ifndef CALC_MMAP
+  vector<char> bytes;
+#endif
+};
+
+#ifdef CALC_MMAP
+
+inline Mapped_file::Mapped_file(const string &path, Access a) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  struct stat sb;
+  if (fstat(fd, &sb) == 0) {
+    opened = sb.st_size == 0;
+    if (sb.st_size > 0) {
+      void *p = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        addr = static_cast<const char *>(p);
+        len = sb.st_size;
+        opened = true;
+        if (a == Access::sequential)
+          madvise(p, len, MADV_SEQUENTIAL);
+      }
+    }
+  }
+  close(fd); // the mapping stays
+}
+
+inline Mapped_file::~Mapped_file() {
+  if (addr)
+    munmap(const_cast<char *>(addr), len);
+}
+
+#else
+
+inline Mapped_file::Mapped_file(const string &path, Access) {
+  ifstream is{path, ios_base::binary | ios_base::ate};
+  if (!is)
+    return;
+  bytes.resize(size_t(is.tellg()));
+  is.seekg(0);
+  if (bytes.empty() || is.read(bytes.data(), bytes.size())) {
+    addr = bytes.data();
+    len = bytes.size();
+    opened = true;
+  }
+}
+
+inline Mapped_file::~Mapped_file() {}
+
+#endif // CALC_MMAP
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,438 @@
+/*
+ * memo.h
+ *
+ * Remembering the values of subexpressions from one statement to the next.
+ *
+ * Scripts repeat themselves: "(a*b+c)" may be computed hundreds of times
+ * between two assignments to a, b or c. A Memo_cache keeps the value of each
+ * subexpression (an operator with its operands) it computes, and uses it
+ * instead of computing it again for as long as the variables it was
+ * computed from keep the values they had.
+ *
+ * The subexpressions are hash-consed: each distinct one is a single node,
+ * found by its operator and its operands (a number, by its bits; a
+ * variable, by its symbol id; or another node), so "a*b+c" is the same node
+ * in every statement it appears in, each time that is compiled. A node
+ * knows which variables it reads, and its value is good while their
+ * generations (see symbol_table.h) are the ones it was computed with. A
+ * subexpression that reads more than max_vars variables isn't remembered
+ * (the ones inside it are).
+ *
+ * The cache holds at most capacity nodes; when it is full, the one used
+ * least recently goes. A node refers to its operands by serial numbers,
+ * which are never reused, so a node whose operand has gone is never found
+ * again, and goes in its turn.
+ *
+ * evaluate() gives exactly try_evaluate()'s results and errors: the code is
+ * run in the same order, only a subexpression whose value is known isn't
+ * run at all (and running it would have given that value, without error).
+ * Finding the nodes costs a hash lookup per operator, every time a
+ * statement is run, and that is more than one of the calculator's
+ * operators costs to compute: with + - * / % as they are, running with the
+ * cache is slower than without it (by about half, on a script that reuses
+ * nine values in ten). The counts say how much a script repeats itself;
+ * the time comes back only for operators that cost more than a lookup, so
+ * the calculator uses the cache only when asked to (--memo), and bench
+ * runs it (as "memo") to measure it against the interpreter.
+ *
+ * A Basic_memo_cache keeps values of type T (see number.h), as the Session
+ * it serves computes them; a number in a subexpression is known by all the
+ * bits of its value. A Memo_cache is the one for doubles.
+ */
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "../lib/std_lib_facilities.h"
+#include "code.h"
+#include "status.h"
+#include "symbol_table.h"
+#include <cstdint>
+#include <cstring>
+
+// the bytes of a T that hold its value: a long double's 80 bits, on x86,
+// without the padding after them
+template <class T>
+constexpr size_t value_bytes =
+    is_same_v<T, long double> && numeric_limits<long double>::digits == 64
+        ? 10
+        : sizeof(T);
+
+template <class T> class Basic_memo_cache {
+public:
+  explicit Basic_memo_cache(int capacity = 1 << 14);
+
+  // try_evaluate(c, st), using the values of subexpressions computed before
+  Expected<T> evaluate(const Basic_code_view<T> &c, Basic_symbol_table<T> &st);
+
+  long hits() const { return nhits; }     // values used again
+  long misses() const { return nmisses; } // values computed (and kept)
+  long evictions() const { return nevictions; }
+  int size() const { return live; } // nodes
+
+  void report(ostream &os) const; // the counts, as report_stats() would
+
+private:
+  static_assert(value_bytes<T> <= 2 * sizeof(uint64_t), "a number's key");
+  static constexpr int max_vars = 8; // read by a node whose value is kept
+  static constexpr int none = -1;
+
+  enum Kind : char { number, variable, node };
+  struct Operand {
+    Kind kind;
+    uint64_t ref[2]; // a number's bits, a symbol id, or a node's serial
+  };
+  struct Key {
+    Op op;
+    Operand left;
+    Operand right; // number 0 for negate
+
+    bool operator==(const Key &k) const {
+      return op == k.op && left.kind == k.left.kind &&
+             left.ref[0] == k.left.ref[0] && left.ref[1] == k.left.ref[1] &&
+             right.kind == k.right.kind && right.ref[0] == k.right.ref[0] &&
+             right.ref[1] == k.right.ref[1];
+    }
+  };
+  struct Node {
+    Key key;
+    unsigned hash;
+    uint64_t serial;
+    int nvars;                      // none: too many to keep the value
+    int vars[max_vars];             // the variables it reads
+    uint64_t generations[max_vars]; // theirs when value was computed
+    bool known;                     // is value there
+    T value;
+    int older; // in order of use
+    int newer;
+  };
+
+  int capacity;
+  vector<Node> nodes; // allocated on first use
+  vector<int> slots;  // open-addressing index into nodes
+  int live{0};
+  int oldest{none};
+  int newest{none};
+  uint64_t serials{0};
+  long nhits{0};
+  long nmisses{0};
+  long nevictions{0};
+
+  // for the code being evaluated, by instruction: an operator's node, and
+  // the outermost subexpression starting there, then the next one in
+  vector<int> node_at;
+  vector<int> first_at;
+  vector<int> next_at;
+  struct Pending {
+    Operand o;
+    int node;  // or none
+    int start; // where its code starts
+  };
+  vector<Pending> operands;
+
+  static unsigned hash_of(const Key &k);
+  int intern(const Key &k, int left, int right); // the node for k
+  void join_vars(Node &n, const Operand &o, int child) const;
+  bool fresh(const Node &n, const Basic_symbol_table<T> &st) const;
+  void remember(Node &n, T v, const Basic_symbol_table<T> &st);
+  void unlink(int n);
+  void link_newest(int n);
+  void forget(int n); // take n out of the index
+};
+
+template <class T>
+Basic_memo_cache<T>::Basic_memo_cache(int capacity) : capacity{capacity} {
+  if (capacity <= 0)
+    error("Memo_cache: capacity must be positive");
+}
+
+template <class T> unsigned Basic_memo_cache<T>::hash_of(const Key &k) {
+  uint64_t h = uint64_t(k.op) << 4 | uint64_t(k.left.kind) << 2 |
+               uint64_t(k.right.kind);
+  for (uint64_t v : {k.left.ref[0], k.left.ref[1], k.right.ref[0],
+                     k.right.ref[1]}) {
+    h ^= v + 0x9E3779B97F4A7C15 + (h << 6) + (h >> 2);
+    h *= 0xFF51AFD7ED558CCD;
+  }
+  return unsigned(h ^ h >> 32);
+}
+
+template <class T> void Basic_memo_cache<T>::unlink(int n) {
+  Node &nd = nodes[n];
+  (nd.older == none ? oldest : nodes[nd.older].newer) = nd.newer;
+  (nd.newer == none ? newest : nodes[nd.newer].older) = nd.older;
+}
+
+template <class T> void Basic_memo_cache<T>::link_newest(int n) {
+  nodes[n].older = newest;
+  nodes[n].newer = none;
+  (newest == none ? oldest : nodes[newest].newer) = n;
+  newest = n;
+}
+
+// remove n from the index, moving back the entries after it that would no
+// longer be found (so there are no tombstones)
+template <class T> void Basic_memo_cache<T>::forget(int n) {
+  const unsigned mask = slots.size() - 1;
+  unsigned i = nodes[n].hash & mask;
+  while (slots[i] != n)
+    i = (i + 1) & mask;
+  for (unsigned j = (i + 1) & mask; slots[j] != none; j = (j + 1) & mask) {
+    const unsigned home = nodes[slots[j]].hash & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) { // i is on its way to j
+      slots[i] = slots[j];
+      i = j;
+    }
+  }
+  slots[i] = none;
+}
+
+// add the variables o reads to n's; too many, and n's value isn't kept
+template <class T>
+void Basic_memo_cache<T>::join_vars(Node &n, const Operand &o,
+                                    int child) const {
+  if (n.nvars == none || o.kind == number)
+    return;
+  if (o.kind == variable) {
+    const int id = int(o.ref[0]);
+    if (find(n.vars, n.vars + n.nvars, id) != n.vars + n.nvars)
+      return;
+    if (n.nvars == max_vars) {
+      n.nvars = none;
+      return;
+    }
+    n.vars[n.nvars++] = id;
+    return;
+  }
+  const Node &c = nodes[child];
+  if (c.nvars == none) {
+    n.nvars = none;
+    return;
+  }
+  for (int k = 0; k < c.nvars && n.nvars != none; ++k)
+    join_vars(n, Operand{variable, {uint64_t(c.vars[k]), 0}}, none);
+}
+
+// the node for k, found or added (and either way the one used last);
+// left and right are the operands' nodes, if they are nodes
+template <class T>
+int Basic_memo_cache<T>::intern(const Key &k, int left, int right) {
+  const unsigned h = hash_of(k);
+  const unsigned mask = slots.size() - 1;
+  unsigned i = h & mask;
+  for (; slots[i] != none; i = (i + 1) & mask) {
+    const int n = slots[i];
+    if (nodes[n].hash == h && nodes[n].key == k) {
+      unlink(n);
+      link_newest(n);
+      return n;
+    }
+  }
+
+  int n = live;
+  if (live == capacity) { // the least recently used goes
+    n = oldest;
+    unlink(n);
+    forget(n);
+    ++nevictions;
+    i = h & mask; // forget() may have moved things
+    while (slots[i] != none)
+      i = (i + 1) & mask;
+  } else {
+    ++live;
+  }
+  slots[i] = n;
+  Node &nd = nodes[n];
+  nd.key = k;
+  nd.hash = h;
+  nd.serial = serials++;
+  nd.nvars = 0;
+  nd.known = false;
+  join_vars(nd, k.left, left);
+  join_vars(nd, k.right, right);
+  link_newest(n);
+  return n;
+}
+
+template <class T>
+bool Basic_memo_cache<T>::fresh(const Node &n,
+                                const Basic_symbol_table<T> &st) const {
+  if (!n.known)
+    return false;
+  for (int k = 0; k < n.nvars; ++k)
+    if (st.generation(n.vars[k]) != n.generations[k])
+      return false;
+  return true;
+}
+
+template <class T>
+void Basic_memo_cache<T>::remember(Node &n, T v,
+                                   const Basic_symbol_table<T> &st) {
+  if (n.nvars == none)
+    return;
+  n.value = v;
+  n.known = true;
+  for (int k = 0; k < n.nvars; ++k)
+    n.generations[k] = st.generation(n.vars[k]);
+  ++nmisses;
+}
+
+template <class T>
+Expected<T> Basic_memo_cache<T>::evaluate(const Basic_code_view<T> &c,
+                                          Basic_symbol_table<T> &st) {
+  int n = c.size; // the expression; a define or assign is done after it
+  const Op last = c.code[n - 1].op;
+  if (last == Op::define || last == Op::assign)
+    --n;
+  if (n > capacity) // its own nodes would push each other out
+    return try_evaluate(c, st);
+  if (nodes.empty()) {
+    nodes.resize(capacity);
+    size_t s = 1;
+    while (s < 2 * size_t(capacity)) // keep the load factor <= 1/2
+      s *= 2;
+    slots.assign(s, none);
+  }
+
+  // the nodes of the code's subexpressions, and where each one starts
+  node_at.assign(n, none);
+  first_at.assign(n, none);
+  next_at.assign(n, none);
+  operands.clear();
+  for (int i = 0; i < n; ++i) {
+    const Instruction &in = c.code[i];
+    switch (in.op) {
+    case Op::number:
+    {
+      Operand o{number, {0, 0}};
+      memcpy(o.ref, &c.constants[in.arg], value_bytes<T>);
+      operands.push_back(Pending{o, none, i});
+      break;
+    }
+    case Op::load:
+      operands.push_back(
+          Pending{Operand{variable, {uint64_t(in.arg), 0}}, none, i});
+      break;
+    case Op::define:
+    case Op::assign: // not in an expression
+      return try_evaluate(c, st);
+    default:
+    {
+      Pending right{Operand{number, {0, 0}}, none, i};
+      if (in.op != Op::negate) {
+        right = operands.back();
+        operands.pop_back();
+      }
+      const Pending left = operands.back();
+      operands.pop_back();
+      const int m =
+          intern(Key{in.op, left.o, right.o}, left.node, right.node);
+      node_at[i] = m;
+      next_at[i] = first_at[left.start];
+      first_at[left.start] = i;
+      operands.push_back(
+          Pending{Operand{node, {nodes[m].serial, 0}}, m, left.start});
+    }
+    }
+  }
+
+  // as try_evaluate(), but a subexpression with a known value is skipped
+  constexpr int small = 64;
+  T local[small];
+  vector<T> large;
+  T *stack = local;
+  if (c.max_depth > small) {
+    large.resize(c.max_depth);
+    stack = large.data();
+  }
+
+  int sp = 0; // stack[sp-1] is the top
+  for (int i = 0; i < n;) {
+    int known = none; // operator ending a subexpression that starts here
+    for (int j = first_at[i]; j != none && known == none; j = next_at[j])
+      if (fresh(nodes[node_at[j]], st))
+        known = j;
+    if (known != none) {
+      ++nhits;
+      stack[sp++] = nodes[node_at[known]].value;
+      i = known + 1;
+      continue;
+    }
+
+    const Instruction &in = c.code[i];
+    switch (in.op) {
+    case Op::number:
+      stack[sp++] = c.constants[in.arg];
+      break;
+    case Op::load:
+      if (!st.is_declared(in.arg))
+        return Calc_error{Errc::undefined_variable, c.pos, in.arg};
+      stack[sp++] = st.value(in.arg);
+      break;
+    case Op::negate:
+      stack[sp - 1] = -stack[sp - 1];
+      break;
+    case Op::add:
+      --sp;
+      stack[sp - 1] += stack[sp];
+      break;
+    case Op::sub:
+      --sp;
+      stack[sp - 1] -= stack[sp];
+      break;
+    case Op::mul:
+      --sp;
+      stack[sp - 1] *= stack[sp];
+      break;
+    case Op::div:
+      --sp;
+      if (stack[sp] == T(0))
+        return Calc_error{Errc::divide_by_zero, c.pos};
+      stack[sp - 1] /= stack[sp];
+      break;
+    case Op::mod:
+      --sp;
+      if (stack[sp] == T(0))
+        return Calc_error{Errc::mod_by_zero, c.pos};
+      stack[sp - 1] = fmod(stack[sp - 1], stack[sp]);
+      break;
+    case Op::define:
+    case Op::assign:
+      break; // not in an expression
+    }
+    if (node_at[i] != none)
+      remember(nodes[node_at[i]], stack[sp - 1], st);
+    ++i;
+  }
+
+  const T v = stack[sp - 1];
+  if (n < c.size) {
+    const Instruction &in = c.code[n];
+    if (in.op == Op::define) {
+      if (st.is_declared(in.arg))
+        return Calc_error{Errc::declared_twice, c.pos, in.arg};
+      st.define(in.arg, v);
+    } else {
+      if (!st.is_declared(in.arg))
+        return Calc_error{Errc::assign_undefined, c.pos, in.arg};
+      if (st.is_constant(in.arg))
+        return Calc_error{Errc::assign_constant, c.pos, in.arg};
+      st.set(in.arg, v);
+    }
+  }
+  return v;
+}
+
+template <class T> void Basic_memo_cache<T>::report(ostream &os) const {
+  const long computed = nhits + nmisses;
+  os << "memo hits   " << setw(14) << nhits << setw(7) << fixed
+     << setprecision(1) << (computed ? 100.0 * nhits / computed : 0.0)
+     << "%\n"
+     << defaultfloat;
+  os << "  computed  " << setw(14) << nmisses << '\n';
+  os << "  nodes     " << setw(14) << live << "  evicted " << nevictions
+     << '\n';
+}
+
+using Memo_cache = Basic_memo_cache<double>;
+
+#endif // MEMO_H
@@ -0,0 +1,162 @@
+/*
+ * number.h
+ *
+ * The arithmetic the calculator can compute in.
+ *
+ * Everything that holds or computes numbers (Basic_code in code.h,
+ * Basic_symbol_table, Basic_session, the statement loops, Basic_batch) is a
+ * template on the type of number, and every Precision is an instantiation
+ * of them, made at compile time; choosing one picks the instantiation
+ * once, before anything runs (see main()), so the loops themselves never
+ * ask which arithmetic they are doing.
+ *
+ *   float32      float: half the bytes per value, so twice the values per
+ *                vector instruction in batch mode; for results that only
+ *                need about seven digits
+ *   float64      double, what the calculator has always computed with
+ *   extended     long double: on x86 the 64-bit significand of the x87
+ *   compensated  Compensated, an unevaluated sum of two doubles (double-
+ *                double arithmetic): about 32 digits, in software
+ *
+ * In a Session of Ts, the literals, the variables (pi and e too) and the
+ * results are all Ts: a value is rounded to a T where it is made, and to
+ * nothing else after that. Literals are read to about 32 digits, as
+ * Compensated (see numbers.h), and rounded to T from there (rounded_to()).
+ * Native code (jit.h) and the script cache (script_cache.h) are for
+ * doubles only.
+ */
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include "../lib/std_lib_facilities.h"
+#include <cmath>
+
+enum class Precision : char { float32, float64, extended, compensated };
+
+// the Precision named s ("float", "double", "long", "compensated")
+inline Precision precision_named(const string &s) {
+  if (s == "float")
+    return Precision::float32;
+  if (s == "double")
+    return Precision::float64;
+  if (s == "long")
+    return Precision::extended;
+  if (s == "compensated")
+    return Precision::compensated;
+  error("unknown precision ", s);
+  return Precision::float64;
+}
+
+/**
+ * A number as the sum of two doubles, hi + lo, with |lo| at most half an
+ * ulp of hi: the operations keep track of the rounding error of double
+ * arithmetic in lo (Dekker's and Knuth's error-free transformations, as in
+ * the QD library), so they round about 2^-104 rather than 2^-53. hi alone
+ * is the value rounded to a double. Infinities and NaNs are just hi.
+ *
+ * % is fmod() of the his: it is exact, but of the rounded operands.
+ */
+struct Compensated {
+  double hi{0};
+  double lo{0};
+
+  Compensated() = default;
+  Compensated(double d) : hi{d} {}
+  Compensated(double h, double l) : hi{h}, lo{l} {}
+
+  explicit operator double() const { return hi; }
+};
+
+// s + e as a Compensated, given |s| >= |e| (or s not finite)
+inline Compensated renormalize(double s, double e) {
+  const double h = s + e;
+  if (!isfinite(h))
+    return Compensated{h};
+  return Compensated{h, e - (h - s)};
+}
+
+// a + b exactly, as the rounded sum and its error
+inline Compensated two_sum(double a, double b) {
+  const double s = a + b;
+  if (!isfinite(s))
+    return Compensated{s};
+  const double bb = s - a;
+  return Compensated{s, (a - (s - bb)) + (b - bb)};
+}
+
+inline Compensated operator+(const Compensated &a, const Compensated &b) {
+  const Compensated s = two_sum(a.hi, b.hi);
+  if (!isfinite(s.hi))
+    return s;
+  const Compensated t = two_sum(a.lo, b.lo);
+  const Compensated u = renormalize(s.hi, s.lo + t.hi);
+  return renormalize(u.hi, u.lo + t.lo);
+}
+
+inline Compensated operator-(const Compensated &a) {
+  return Compensated{-a.hi, -a.lo};
+}
+
+inline Compensated operator-(const Compensated &a, const Compensated &b) {
+  return a + -b;
+}
+
+inline Compensated operator*(const Compensated &a, const Compensated &b) {
+  const double p = a.hi * b.hi;
+  if (!isfinite(p) || p == 0)
+    return Compensated{p};
+  const double e = fma(a.hi, b.hi, -p); // the error of p, exactly
+  return renormalize(p, e + (a.hi * b.lo + a.lo * b.hi));
+}
+
+inline Compensated operator/(const Compensated &a, const Compensated &b) {
+  const double q = a.hi / b.hi;
+  if (!isfinite(q) || q == 0)
+    return Compensated{q};
+  // one step of long division: the remainder a - q*b, divided again
+  const Compensated r = a - b * Compensated{q};
+  return renormalize(q, r.hi / b.hi);
+}
+
+inline Compensated fmod(const Compensated &a, const Compensated &b) {
+  return Compensated{fmod(a.hi, b.hi)};
+}
+
+inline Compensated &operator+=(Compensated &a, const Compensated &b) {
+  return a = a + b;
+}
+inline Compensated &operator-=(Compensated &a, const Compensated &b) {
+  return a = a - b;
+}
+inline Compensated &operator*=(Compensated &a, const Compensated &b) {
+  return a = a * b;
+}
+inline Compensated &operator/=(Compensated &a, const Compensated &b) {
+  return a = a / b;
+}
+
+inline bool operator==(const Compensated &a, const Compensated &b) {
+  return a.hi == b.hi && a.lo == b.lo;
+}
+
+// written as its hi: six digits never show the lo
+inline ostream &operator<<(ostream &os, const Compensated &c) {
+  return os << c.hi;
+}
+
+// does T hold more than a double does, so that literals are worth reading
+// to more digits than a double takes
+template <class T>
+constexpr bool wider_than_double = sizeof(T) > sizeof(double);
+
+// c (a literal, read to about 32 digits) rounded to T, once
+template <class T> T rounded_to(const Compensated &c) {
+  if constexpr (is_same_v<T, Compensated>)
+    return c;
+  else if constexpr (wider_than_double<T>)
+    return T(c.hi) + T(c.lo);
+  else
+    return T(c.hi);
+}
+
+#endif // NUMBER_H
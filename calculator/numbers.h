@@ -0,0 +1,225 @@
+/*
+ * numbers.h
+ *
+ * Reading floating-point literals quickly, and correctly rounded.
+ *
+ * parse_number() is from_chars() for the literals the calculator reads,
+ * with a fast path for the common ones. Digits are taken eight at a time
+ * (checked and converted as one 64-bit word, "SWAR"), and a literal with
+ * at most 19 significant digits whose value is m * 10^e with m < 2^53 and
+ * |e| <= 22 is computed with a single multiplication or division of two
+ * exactly representable doubles: that one rounding is the only one, so
+ * the result is the correctly rounded value (Clinger's fast path, as
+ * fast_float has it). Anything else goes to from_chars() itself, which in
+ * libstdc++ (since GCC 12) is fast_float's Eisel-Lemire algorithm, with
+ * exact big-number arithmetic behind that; it also decides what is an
+ * error. Either way the result, and where the literal ends, are exactly
+ * what from_chars() gives.
+ *
+ * For arithmetic wider than double (see number.h), a literal can also be
+ * read as a Compensated: its hi is what parse_number() gives for a double,
+ * and its lo the rest of the literal's value, from the first 31 significant
+ * digits and their power of ten, worked out in Compensated arithmetic (so
+ * to within a few units of 2^-104). Literals so small or so large that a
+ * Compensated is no wider than a double get no lo.
+ *
+ * The word-at-a-time tricks assume a little-endian machine; elsewhere the
+ * digits are taken one at a time.
+ */
+#ifndef NUMBERS_H
+#define NUMBERS_H
+
+#include "../lib/std_lib_facilities.h"
+#include "number.h"
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CALC_SWAR 1
+#endif
+
+// are the 8 characters at p all digits
+inline bool eight_digits(const char *p) {
+#ifdef CALC_SWAR
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return ((v & 0xF0F0F0F0F0F0F0F0) |
+          (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) ==
+         0x3333333333333333;
+#else
+  for (int i = 0; i < 8; ++i)
+    if (p[i] < '0' || '9' < p[i])
+      return false;
+  return true;
+#endif
+}
+
+// the value of the 8 digits at p
+inline uint32_t eight_digits_value(const char *p) {
+#ifdef CALC_SWAR
+  uint64_t v;
+  memcpy(&v, p, 8);
+  v -= 0x3030303030303030;
+  v = v * 10 + (v >> 8); // pairs of digits
+  v = (((v & 0x000000FF000000FF) * (100 + (1000000ULL << 32))) +
+       (((v >> 16) & 0x000000FF000000FF) * (1 + (10000ULL << 32)))) >>
+      32;
+  return uint32_t(v);
+#else
+  uint32_t v = 0;
+  for (int i = 0; i < 8; ++i)
+    v = v * 10 + (p[i] - '0');
+  return v;
+#endif
+}
+
+// the end of the run of digits starting at p (and ending by end)
+inline const char *digits_end(const char *p, const char *end) {
+  while (end - p >= 8 && eight_digits(p))
+    p += 8;
+  while (p < end && '0' <= *p && *p <= '9')
+    ++p;
+  return p;
+}
+
+// from_chars(first, last, v) for a double, the general format
+inline from_chars_result parse_number(const char *first, const char *last,
+                                      double &v) {
+  // the exact powers of ten a double holds
+  static constexpr double powers[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  constexpr int max_digits = 19; // without overflowing m
+  constexpr uint64_t max_exact = uint64_t(1) << 53;
+
+  const char *p = first;
+  uint64_t m = 0; // the digits, as an integer; wraps if there are too many
+  auto take_digits = [&] {
+    const char *run = p;
+    while (last - p >= 8 && eight_digits(p)) {
+      m = m * 100000000 + eight_digits_value(p);
+      p += 8;
+    }
+    for (; p < last && '0' <= *p && *p <= '9'; ++p)
+      m = m * 10 + (*p - '0');
+    return int(p - run);
+  };
+
+  int digits = take_digits();
+  int exponent = 0; // of ten
+  if (p < last && *p == '.') {
+    ++p;
+    exponent = -take_digits();
+    digits -= exponent;
+  }
+  if (digits == 0)
+    return from_chars(first, last, v);
+  if (digits > max_digits) { // unless most of them are leading zeros
+    for (const char *q = first; q < p && (*q == '0' || *q == '.'); ++q)
+      digits -= *q == '0';
+    if (digits > max_digits)
+      return from_chars(first, last, v);
+  }
+
+  if (p < last && (*p == 'e' || *p == 'E')) {
+    const char *q = p + 1;
+    const bool negative = q < last && *q == '-';
+    if (q < last && (*q == '-' || *q == '+'))
+      ++q;
+    if (q < last && '0' <= *q && *q <= '9') { // otherwise no exponent
+      int e = 0;
+      for (; q < last && '0' <= *q && *q <= '9'; ++q)
+        if (e < 10000) // far beyond the fast path anyway
+          e = e * 10 + (*q - '0');
+      exponent += negative ? -e : e;
+      p = q;
+    }
+  }
+
+  if (m > max_exact || exponent < -22 || 22 < exponent)
+    return from_chars(first, last, v);
+  const double d = double(m);
+  v = exponent < 0 ? d / powers[-exponent] : d * powers[exponent];
+  return from_chars_result{p, errc{}};
+}
+
+// 10^n, for 0 <= n <= 308, in Compensated arithmetic
+inline Compensated compensated_power_of_ten(int n) {
+  Compensated r{1};
+  Compensated square{10}; // 10^(2^k)
+  for (; n > 0; n >>= 1) {
+    if (n & 1)
+      r *= square;
+    if (n > 1)
+      square *= square;
+  }
+  return r;
+}
+
+// parse_number() for a Compensated: the same hi, and the same end
+inline from_chars_result parse_number(const char *first, const char *last,
+                                      Compensated &v) {
+  constexpr int max_digits = 31; // as many as a Compensated holds
+  double hi;
+  const from_chars_result r = parse_number(first, last, hi);
+  if (r.ec != errc{})
+    return r;
+  v = Compensated{hi};
+  if (!isfinite(hi) || hi == 0)
+    return r;
+
+  Compensated m; // the significant digits, as an integer
+  int digits = 0;
+  int exponent = 0; // of ten
+  bool point = false;
+  const char *p = first;
+  for (; p < r.ptr && *p != 'e' && *p != 'E'; ++p) {
+    if (*p == '.') {
+      point = true;
+    } else if (digits < max_digits && (digits > 0 || *p != '0')) {
+      m = m * Compensated{10} + Compensated{double(*p - '0')};
+      ++digits;
+      exponent -= point;
+    } else if (digits == 0) { // a leading zero
+      exponent -= point;
+    } else { // a digit beyond max_digits
+      exponent += !point;
+    }
+  }
+  if (p < r.ptr) { // the exponent, which parse_number() took as well
+    ++p;
+    const bool negative = *p == '-';
+    if (*p == '-' || *p == '+')
+      ++p;
+    int e = 0;
+    for (; p < r.ptr; ++p)
+      if (e < 10000)
+        e = e * 10 + (*p - '0');
+    exponent += negative ? -e : e;
+  }
+  if (exponent < -290 || 308 < exponent) // beyond lo's range, or 10^n's
+    return r;
+
+  const Compensated x = exponent < 0
+                            ? m / compensated_power_of_ten(-exponent)
+                            : m * compensated_power_of_ten(exponent);
+  const double lo = (x - Compensated{hi}).hi;
+  if (isfinite(lo) && hi + lo == hi) // at most half an ulp, as it should be
+    v.lo = lo;
+  return r;
+}
+
+// s, which is all a literal, rounded to T as a Token_stream of Ts reads it
+// (see number.h); 0 if it isn't one
+template <class T> T parse_literal(string_view s) {
+  Compensated c;
+  if constexpr (wider_than_double<T>)
+    parse_number(s.data(), s.data() + s.size(), c);
+  else
+    parse_number(s.data(), s.data() + s.size(), c.hi);
+  return rounded_to<T>(c);
+}
+
+#endif // NUMBERS_H
@@ -0,0 +1,137 @@
+/*
+ * optimize.h
+ *
+ * Simplifying compiled code before it is run.
+ *
+ * optimize() rewrites a Code so that it does less work and still gives
+ * exactly the same results, including the same errors:
+ *   - an operator whose operands are all constants is replaced by its value;
+ *     constant variables (pi, e) count as constants
+ *   - x*1, 1*x, x/1 and x-0 become x
+ *   - -(-x) becomes x
+ *
+ * Some tempting rewrites are deliberately not done:
+ *   - x/0 and x%0 are left for evaluate() to report, when the code is run
+ *   - x+0 is not x when x is -0 (the sum is +0), so it stays
+ *   - 0*x is not 0 when x is infinite, or not yet defined, so it stays
+ *
+ * The constants are Ts, the numbers the code will be run with (see
+ * number.h), and they are folded in T, as try_evaluate() would compute
+ * them: in float, "0.1+0.2" is folded to the sum of two floats.
+ */
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "../lib/std_lib_facilities.h"
+#include "arena.h"
+#include "code.h"
+#include "symbol_table.h"
+
+// apply op to two constants, computing in T; false if that has to wait
+// for run time
+template <class T> bool fold(Op op, T a, T b, T &r) {
+  switch (op) {
+  case Op::add:
+    r = a + b;
+    return true;
+  case Op::sub:
+    r = a - b;
+    return true;
+  case Op::mul:
+    r = a * b;
+    return true;
+  case Op::div:
+    if (b == T(0))
+      return false;
+    r = a / b;
+    return true;
+  case Op::mod:
+    if (b == T(0))
+      return false;
+    r = fmod(a, b);
+    return true;
+  default:
+    return false;
+  }
+}
+
+// the working lists are taken from scratch
+template <class T>
+void optimize(Basic_code<T> &c, const Basic_symbol_table<T> &st,
+              Arena &scratch) {
+  struct Item {
+    Op op;
+    int arg;
+    T value; // for a number
+  };
+  // the code is postfix, so every operand on the evaluation stack was
+  // computed by a contiguous run of items ending where the next one starts
+  Arena_vector<Item> out{Arena_allocator<Item>{scratch}};
+  // out index at which each stack operand begins
+  Arena_vector<int> start{Arena_allocator<int>{scratch}};
+  out.reserve(c.code.size());
+  start.reserve(c.max_depth);
+
+  for (const Instruction &in : c.code) {
+    switch (in.op) {
+    case Op::number:
+      start.push_back(out.size());
+      out.push_back(Item{Op::number, 0, c.constants[in.arg]});
+      break;
+    case Op::load:
+      start.push_back(out.size());
+      if (st.is_declared(in.arg) && st.is_constant(in.arg))
+        out.push_back(Item{Op::number, 0, st.get(in.arg)});
+      else
+        out.push_back(Item{Op::load, in.arg, T(0)});
+      break;
+    case Op::negate: {
+      Item &last = out.back();
+      if (start.back() == int(out.size()) - 1 && last.op == Op::number)
+        last.value = -last.value;
+      else if (last.op == Op::negate) // -(-x)
+        out.pop_back();
+      else
+        out.push_back(Item{Op::negate, 0, T(0)});
+      break;
+    }
+    case Op::define:
+    case Op::assign:
+      out.push_back(Item{in.op, in.arg, T(0)});
+      break;
+    default: { // a binary operator
+      const int b = start.back();
+      start.pop_back();
+      const int a = start.back();
+      const bool a_number = b == a + 1 && out[a].op == Op::number;
+      const bool b_number =
+          b == int(out.size()) - 1 && out[b].op == Op::number;
+      T r;
+      if (a_number && b_number &&
+          fold(in.op, out[a].value, out[b].value, r)) {
+        out.pop_back();
+        out.back().value = r;
+      } else if (b_number && out[b].value == T(1) &&
+                 (in.op == Op::mul || in.op == Op::div)) {
+        out.pop_back(); // x*1, x/1
+      } else if (b_number && out[b].value == T(0) &&
+                 !signbit(double(out[b].value)) && in.op == Op::sub) {
+        out.pop_back(); // x-0
+      } else if (a_number && out[a].value == T(1) && in.op == Op::mul) {
+        out.erase(out.begin() + a); // 1*x
+      } else {
+        out.push_back(Item{in.op, 0, T(0)});
+      }
+    }
+    }
+  }
+
+  c.clear();
+  for (const Item &it : out)
+    if (it.op == Op::number)
+      c.emit_number(it.value);
+    else
+      c.emit(it.op, it.arg);
+}
+
+#endif // OPTIMIZE_H
@@ -0,0 +1,76 @@
+/*
+ * output.h
+ *
+ * Writing results quickly, for output that nobody reads as it appears.
+ *
+ * An Output collects text in a large buffer and hands it to its ostream in
+ * big chunks, instead of going through the ostream's formatting (and its
+ * sentry) for every value. Doubles are formatted with to_chars() as %g with
+ * six significant digits: what operator<< writes for a double on a stream
+ * with the default flags and precision, so the bytes come out the same.
+ * The other numbers (see number.h) come out as operator<< writes them too.
+ */
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "../lib/std_lib_facilities.h"
+#include "number.h"
+#include <charconv>
+
+class Output {
+public:
+  explicit Output(ostream &os, size_t capacity = 1 << 16)
+      : os{os}, buf(max(capacity, max_number)) {}
+  ~Output() { flush(); }
+
+  Output(const Output &) = delete;
+  Output &operator=(const Output &) = delete;
+
+  void put(char c) {
+    if (used == buf.size())
+      flush();
+    buf[used++] = c;
+  }
+
+  void put(const string &s) {
+    if (buf.size() - used < s.size()) {
+      flush();
+      if (buf.size() < s.size()) { // doesn't fit at all
+        os.write(s.data(), s.size());
+        return;
+      }
+    }
+    copy(s.begin(), s.end(), buf.data() + used);
+    used += s.size();
+  }
+
+  void put(double d) {
+    if (buf.size() - used < max_number)
+      flush();
+    char *p = buf.data() + used;
+    used += to_chars(p, p + max_number, d, chars_format::general, 6).ptr - p;
+  }
+  void put(long double d) {
+    if (buf.size() - used < max_number)
+      flush();
+    char *p = buf.data() + used;
+    used += to_chars(p, p + max_number, d, chars_format::general, 6).ptr - p;
+  }
+  void put(const Compensated &c) { put(c.hi); }
+
+  // write what has been collected; do this before writing to os (or to a
+  // stream that may share its destination, like cerr) directly
+  void flush() {
+    os.write(buf.data(), used);
+    used = 0;
+  }
+
+private:
+  static constexpr size_t max_number = 32; // enough for any %.6g
+
+  ostream &os;
+  vector<char> buf;
+  size_t used{0};
+};
+
+#endif // OUTPUT_H
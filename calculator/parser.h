@@ -0,0 +1,311 @@
+/*
+ * parser.h
+ *
+ * The calculator's parser.
+ *
+ * The parser compiles as it reads: each function appends the code for the
+ * construct it recognizes to c instead of computing its value. See code.h.
+ * Statements are read from, and compiled against, a Session.
+ *
+ * Each step comes in two flavors: try_compile_statement() and
+ * try_statement() report errors by returning a Calc_error (see status.h);
+ * compile_statement() and statement() throw the corresponding message.
+ */
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "../lib/std_lib_facilities.h"
+#include "arena.h"
+#include "code.h"
+#include "optimize.h"
+#include "reactive.h"
+#include "session.h"
+#include "status.h"
+#include "token_stream.h"
+
+/**
+ * Grammar
+ * Reading a stream of tokens according to a grammar is called parsing,
+ * and a program that does that is often called a parser or a syntax analyzer.
+ *
+ * // a simple expression grammar:
+ * Expression:
+ *      Term
+ *      Expression + Term    // addition
+ *      Expression - Term    // subtraction
+ * Term:
+ *      Primary
+ *      Term * Primary       // multiplication
+ *      Term / Primary       // division
+ *      Term % Primary       // remainder (modulo)
+ * Primary:
+ *      Number
+ *      ( Expression )       // grouping
+ *      + Primary
+ *      - Primary
+ * Number:
+ *      floating-point-literal
+ */
+
+// The parse functions return false when the input doesn't fit the grammar,
+// having said why in e. A bad Token is reported as soon as the parser meets
+// it: either it is the one just got, or it is the next one, peeked at (and
+// left alone) when expression() is done.
+
+// record what went wrong; returns false for the parse functions to return
+inline bool fail(Calc_error &e, Errc code, long pos, int id = -1) {
+  e = Calc_error{code, pos, id};
+  return false;
+}
+
+// Expression, Term and Primary are parsed by one loop with an explicit
+// stack (operator precedence parsing), rather than by functions calling
+// each other, so that nesting depth costs heap, not call stack: a thousand
+// "(" or "-" in a row is no problem. The stack holds the operators still
+// waiting for their right operand: binary operators, unary minus ('n'),
+// and a '(' for each parenthesis not yet closed.
+//
+// The tokens are read, and the code is emitted, in exactly the order the
+// grammar's recursive descent would read and emit them, so the errors and
+// the position in the input after an error are the same too.
+
+// is op on the stack a binary operator at least as tight as one of level
+// (1: + -, 2: * / %)? Those get their code emitted before the new one.
+inline bool binds_first(char op, int level) {
+  switch (op) {
+  case '*':
+  case '/':
+  case '%':
+    return true;
+  case '+':
+  case '-':
+    return level == 1;
+  default: // '(' and 'n'
+    return false;
+  }
+}
+
+template <class T> void emit_operator(Basic_code<T> &c, char op) {
+  switch (op) {
+  case '+':
+    c.emit(Op::add);
+    break;
+  case '-':
+    c.emit(Op::sub);
+    break;
+  case '*':
+    c.emit(Op::mul);
+    break;
+  case '/': // the divide-by-zero check happens when the code is run
+    c.emit(Op::div);
+    break;
+  case '%':
+    c.emit(Op::mod);
+    break;
+  case 'n':
+    c.emit(Op::negate);
+    break;
+  }
+}
+
+// the operator stack is taken from scratch; the literals are rounded to T
+template <class T>
+bool expression(Token_stream &ts, Basic_code<T> &c, Calc_error &e,
+                Arena &scratch) {
+  Arena_vector<char> ops{Arena_allocator<char>{scratch}};
+  ops.reserve(64);
+  while (true) {
+    // a Primary
+    Token t = ts.get();
+    switch (t.kind) {
+    case '(': // ( Expression )
+      ops.push_back('(');
+      continue;
+    case '-': // -Primary
+      ops.push_back('n');
+      continue;
+    case '+': // +Primary
+      continue;
+    case '8':
+      c.emit_number(rounded_to<T>(t.value));
+      break;
+    case name:
+      c.emit(Op::load, t.id);
+      break;
+    case bad:
+      return fail(e, Errc::bad_token, ts.position());
+    default:
+      return fail(e, Errc::primary_expected, ts.position());
+    }
+
+    // we have an operand; what follows it?
+    while (true) {
+      while (!ops.empty() && ops.back() == 'n') { // -Primary is complete
+        c.emit(Op::negate);
+        ops.pop_back();
+      }
+      const char k = ts.peek().kind;
+      const int level = k == '+' || k == '-'              ? 1
+                        : k == '*' || k == '/' || k == '%' ? 2
+                                                           : 0;
+      while (!ops.empty() && binds_first(ops.back(), max(level, 1))) {
+        emit_operator(c, ops.back());
+        ops.pop_back();
+      }
+      if (level) { // Term * Primary, Expression + Term, ...
+        ts.get();
+        ops.push_back(k);
+        break; // on to the right operand
+      }
+      if (ops.empty())
+        return true; // leave the token in the stream for our caller
+
+      // the end of a parenthesized Expression
+      ops.pop_back(); // the '('
+      t = ts.get();
+      if (t.kind == bad)
+        return fail(e, Errc::bad_token, ts.position());
+      if (t.kind != ')')
+        return fail(e, Errc::rparen_expected, ts.position());
+    }
+  }
+}
+
+// assume we have seen "let"
+// handle: name = expression
+// declare a variable called "name" with the initial value "expression"
+template <class T>
+bool declaration(Token_stream &ts, Basic_code<T> &c, Calc_error &e,
+                 Arena &scratch) {
+  Token t = ts.get();
+  if (t.kind == bad)
+    return fail(e, Errc::bad_token, ts.position());
+  if (t.kind != name)
+    return fail(e, Errc::name_expected, ts.position());
+  int var = t.id;
+  Token t2 = ts.get();
+  if (t2.kind == bad)
+    return fail(e, Errc::bad_token, ts.position());
+  if (t2.kind != '=')
+    return fail(e, Errc::equal_expected, ts.position(), var);
+  if (!expression(ts, c, e, scratch))
+    return false;
+  c.emit(Op::define, var);
+  return true;
+}
+
+// assume we have seen (peeked at) a name followed by "="
+// handle: name = expression
+// give the (declared) variable "name" the value of "expression"
+template <class T>
+bool assignment(Token_stream &ts, Basic_code<T> &c, Calc_error &e,
+                Arena &scratch) {
+  int var = ts.get().id;
+  ts.get(); // the '='
+  if (!expression(ts, c, e, scratch))
+    return false;
+  c.emit(Op::assign, var);
+  return true;
+}
+
+// read one Statement from s and compile it into c; the temporaries come
+// from s.scratch, which is reset first
+template <class T>
+Calc_error try_compile_statement(Basic_session<T> &s, Basic_code<T> &c) {
+  CALC_SPAN(parsing);
+  Calc_error e;
+  s.scratch.reset();
+  c.clear();
+  c.pos = s.ts.next_position();
+  bool ok;
+  switch (s.ts.peek().kind) {
+  case let:
+    s.ts.get();
+    ok = declaration(s.ts, c, e, s.scratch);
+    break;
+  case name:
+    if (s.ts.peek(1).kind == '=') {
+      ok = assignment(s.ts, c, e, s.scratch);
+      break;
+    }
+    [[fallthrough]];
+  default:
+    ok = expression(s.ts, c, e, s.scratch);
+  }
+  if (ok && s.ts.peek().kind == bad)
+    fail(e, Errc::bad_token, s.ts.next_position());
+  if (e.ok())
+    optimize(c, s.names, s.scratch);
+  else
+    CALC_COUNT_ERROR(e.code);
+  return e;
+}
+
+// run a compiled Statement in s, without throwing; in a reactive Session,
+// keep what depends on what up to date too (see reactive.h): the result is
+// the statement's, and the variables that couldn't be recomputed are left
+// for stale_report()
+template <class T>
+Expected<T> try_run(Basic_session<T> &s, const Basic_code_view<T> &c) {
+  CALC_SPAN(evaluation);
+  if (s.reactive)
+    s.dependencies.clear_failures(); // the last statement's
+  Expected<T> r =
+      s.memoize ? s.memo.evaluate(c, s.names) : try_evaluate(c, s.names);
+  if (!r)
+    CALC_COUNT_ERROR(r.error().code);
+  if (!r || !s.reactive)
+    return r;
+  const Instruction &last = c.code[c.size - 1];
+  switch (last.op) {
+  case Op::define:
+    s.dependencies.declare(c);
+    break;
+  case Op::assign:
+    s.dependencies.assigned(last.arg, s.names);
+    for (size_t i = 0; i < s.dependencies.failures().size(); ++i)
+      CALC_COUNT_ERROR(s.dependencies.failures()[i].e.code);
+    break;
+  default:
+    break;
+  }
+  return r;
+}
+
+// after try_run() in a reactive Session: a line for each variable the
+// statement should have recomputed, but whose formula failed, naming it
+// and saying why; empty if there are none
+template <class T> string stale_report(const Basic_session<T> &s) {
+  string report;
+  if (s.reactive)
+    for (const auto &f : s.dependencies.failures())
+      report += s.names.name(f.var) + " keeps its old value: " +
+                message(f.e, s.names) + '\n';
+  return report;
+}
+
+// compile and run one Statement, without throwing
+template <class T>
+Expected<T> try_statement(Basic_session<T> &s, Basic_code<T> &c) {
+  Calc_error e = try_compile_statement(s, c);
+  if (!e.ok())
+    return e;
+  return try_run(s, c.view());
+}
+
+// read one Statement from s and compile it into c; throw if that fails
+template <class T>
+void compile_statement(Basic_session<T> &s, Basic_code<T> &c) {
+  Calc_error e = try_compile_statement(s, c);
+  if (!e.ok())
+    error(message(e, s.names));
+}
+
+// compile and run one Statement
+template <class T> T statement(Basic_session<T> &s) {
+  Basic_code<T> c;
+  compile_statement(s, c);
+  return evaluate(c, s.names);
+}
+
+#endif // PARSER_H
@@ -0,0 +1,247 @@
+/*
+ * pipeline.h
+ *
+ * Calculating one input stream on three threads at once: one lexes, one
+ * parses and compiles, and the calling thread runs the statements and
+ * writes the results, each stage working on a later part of the input
+ * than the one after it. The output is exactly calculate_unprompted()'s.
+ *
+ *   lexer --Spsc_queue<Scanned>--> parser --Spsc_queue<Compiled>--> runner
+ *
+ * Each stage has a table of its own. The lexer interns the names;
+ * whenever it meets a new one it publishes it (a Name_list, behind a
+ * mutex, which is taken about once per new name) before passing on the
+ * token, and the later stages intern the published names in the same
+ * order, so a symbol id means the same everywhere. The parser needs no
+ * values (only constants are folded, and those are the same in every
+ * table), so declarations put no barrier between parsing and running:
+ * only the runner's table has values, and statements run in order.
+ *
+ * The one way a statement's run changes what comes after it is failing:
+ * calculate_unprompted() then skips the input up to the next ';'. If the
+ * statement is followed by its ';', as statements mostly are, that skips
+ * just the ';', which the parser would have eaten anyway, so the parser
+ * doesn't wait. Otherwise ("1/0 2;") the statement is a barrier: the
+ * parser waits for the runner to say whether it failed, and skips as
+ * calculate_unprompted() would if it did.
+ *
+ * Only the three stages overlap: the statements themselves are run one
+ * after another, in order, on the calling thread, however independent of
+ * each other they are. What is gained is the lexing and parsing of the
+ * statements ahead, done while the earlier ones run. A stage that has
+ * nothing to do sleeps (see spsc_queue.h) rather than spin.
+ *
+ * This reads ahead of the statements being run, so it is for input from
+ * files and pipes, not from a person at a terminal.
+ */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "../lib/std_lib_facilities.h"
+#include "calculator.h"
+#include "output.h"
+#include "parser.h"
+#include "session.h"
+#include "spsc_queue.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+// the names interned so far, in symbol id order, as the lexer publishes
+// them for the other stages
+class Name_list {
+public:
+  // publish st's names that haven't been
+  void publish(const Symbol_names &st);
+  // intern in st the published names it doesn't have yet, up to n of them
+  void update(Symbol_names &st, int n);
+
+private:
+  mutex m;
+  vector<string> names;
+};
+
+inline void Name_list::publish(const Symbol_names &st) {
+  lock_guard<mutex> g{m};
+  for (int id = names.size(); id < st.size(); ++id)
+    names.push_back(st.name(id));
+}
+
+inline void Name_list::update(Symbol_names &st, int n) {
+  if (st.size() >= n)
+    return;
+  lock_guard<mutex> g{m};
+  while (st.size() < n)
+    st.intern(names[st.size()]);
+}
+
+// a token on its way from the lexer to the parser
+struct Scanned {
+  Token t;
+  long where{0};
+  bool end{false}; // the quit at the end of the input
+  int names{0};    // how many names the lexer had interned by then
+};
+
+// a statement on its way from the parser to the runner
+template <class T> struct Compiled {
+  enum Kind { statement, failed, exception, quit };
+  Kind kind{quit};
+  Basic_code<T> c;     // statement: the code to run
+  Calc_error e;        // failed: why it didn't compile
+  string what;         // exception: what was thrown
+  bool barrier{false}; // statement: the parser waits to hear if it fails
+  int names{0};        // how many names were interned by then
+};
+
+// what the parser reads: the lexer's tokens, keeping the parser's table
+// (see keep_in_step()) in step with the lexer's
+class Scanned_source : public Token_source {
+public:
+  Scanned_source(Spsc_queue<Scanned> &q, Name_list &nl,
+                 const atomic<bool> &stop)
+      : q{q}, names{nl}, stop{stop} {}
+
+  void keep_in_step(Symbol_names &t) { st = &t; }
+  bool next(Token &t, long &where) override;
+
+private:
+  Spsc_queue<Scanned> &q;
+  Name_list &names;
+  const atomic<bool> &stop;
+  Symbol_names *st{nullptr};
+  Scanned s;
+  bool ended{false};
+};
+
+inline bool Scanned_source::next(Token &t, long &where) {
+  if (!ended && !q.pop(s, stop)) { // stopped: as good as the end
+    s = Scanned{Token{quit}, where, true, 0};
+  }
+  ended = s.end;
+  if (st)
+    names.update(*st, s.names);
+  t = s.t;
+  where = s.where;
+  return !ended;
+}
+
+// lex all of is into q, publishing names in nl as they are first seen;
+// wide: read the literals as a wide Token_stream does
+inline void lex_stage(istream &is, Spsc_queue<Scanned> &q, Name_list &nl,
+                      bool wide, const atomic<bool> &stop) {
+  Symbol_names st = constants<double>(); // the constants' names, that is
+  Token_stream ts{st, is, Token_stream::Mode::block};
+  ts.set_wide(wide);
+  int published = st.size();
+  nl.publish(st);
+  Scanned s;
+  do {
+    s.t = ts.get();
+    s.where = ts.position();
+    // the quit at the end stays where it is; a "q" moves on
+    s.end = s.t.kind == quit && ts.next_position() == s.where;
+    if (st.size() > published) {
+      nl.publish(st);
+      published = st.size();
+    }
+    s.names = published;
+  } while (q.push(s, stop) && !s.end);
+}
+
+// compile every statement the lexer passes on into q, as
+// calculate_unprompted() would, for running in Ts; after a barrier, wait
+// for failed to say whether it failed
+template <class T>
+void parse_stage(Spsc_queue<Scanned> &tokens, Name_list &nl,
+                 Spsc_queue<Compiled<T>> &q, Spsc_queue<char> &failed,
+                 const atomic<bool> &stop) {
+  Scanned_source src{tokens, nl, stop};
+  Basic_session<T> s{src};
+  src.keep_in_step(s.names);
+  Compiled<T> out;
+  while (true) {
+    while (s.ts.peek().kind == print)
+      s.ts.get(); // eat ';'
+    if (s.ts.peek().kind == quit) {
+      out.kind = Compiled<T>::quit;
+      q.push(out, stop);
+      return;
+    }
+    try {
+      out.e = try_compile_statement(s, out.c);
+      out.kind = out.e.ok() ? Compiled<T>::statement : Compiled<T>::failed;
+    } catch (exception &e) {
+      out.kind = Compiled<T>::exception;
+      out.what = e.what();
+    }
+    out.barrier =
+        out.kind == Compiled<T>::statement && s.ts.peek().kind != print;
+    out.names = s.names.size();
+    const bool skip = out.kind != Compiled<T>::statement;
+    const bool wait = out.barrier;
+    if (!q.push(out, stop))
+      return;
+    char f = false;
+    if (wait && !failed.pop(f, stop))
+      return;
+    if (skip || f)
+      s.ts.ignore(print);
+  }
+}
+
+// calculate_unprompted(), pipelined: is is lexed and parsed on threads of
+// their own while s runs the statements
+template <class T>
+void calculate_pipelined(Basic_session<T> &s, istream &is = cin,
+                         ostream &os = cout, ostream &err = cerr) {
+  constexpr int queue_size = 4096;
+  Spsc_queue<Scanned> tokens{queue_size};
+  Spsc_queue<Compiled<T>> statements{queue_size / 4};
+  Spsc_queue<char> failed{2}; // the barrier statements' fates
+  Name_list names;
+  atomic<bool> stop{false};
+  thread lexer{
+      [&] { lex_stage(is, tokens, names, wider_than_double<T>, stop); }};
+  thread parser{[&] { parse_stage(tokens, names, statements, failed, stop); }};
+
+  {
+    Output out{os};
+    Compiled<T> in;
+    while (statements.pop(in, stop) && in.kind != Compiled<T>::quit) {
+      names.update(s.names, in.names);
+      bool ok = false;
+      try {
+        if (in.kind == Compiled<T>::exception)
+          error(in.what); // reported as calculate_unprompted() does
+        Expected<T> r = in.kind == Compiled<T>::statement
+                            ? try_run(s, in.c.view())
+                            : Expected<T>{in.e};
+        if (r) {
+          out.put(result);
+          out.put(*r);
+          out.put('\n');
+          report_stale(s, out, err);
+          ok = true;
+        } else {
+          out.flush(); // keep the error in its place if os and err are shared
+          err << message(r.error(), s.names) << '\n';
+        }
+      } catch (exception &e) {
+        out.flush();
+        err << e.what() << '\n';
+      }
+      char f = !ok;
+      if (in.barrier)
+        failed.push(f, stop);
+    }
+  }
+  stop = true; // for a "q" before the end of the input
+  tokens.wake();
+  statements.wake();
+  failed.wake();
+  lexer.join();
+  parser.join();
+}
+
+#endif // PIPELINE_H
@@ -0,0 +1,172 @@
+/*
+ * reactive.h
+ *
+ * Keeping declared variables up to date, like the cells of a spreadsheet.
+ *
+ * In a reactive Session, "let x = a*b" doesn't just give x the value a*b
+ * has at the time: x keeps its compiled expression (its formula), and when
+ * a, or b, or any variable those were computed from, is assigned a new
+ * value ("a = 7"), x is computed again. Only the variables downstream of
+ * the assignment are recomputed, each of them once, and each after the
+ * variables its formula uses.
+ *
+ * A formula can only use variables that were declared before it, so the
+ * order of declaration is a topological order of the dependency graph:
+ * recomputing the affected variables in that order (smallest first, from a
+ * heap) always finds a variable's inputs already up to date.
+ *
+ * Assigning to a variable that has a formula replaces the formula by the
+ * value; the variable is an input from then on.
+ *
+ * A formula can fail on the new values ("let b = 1/(a-2)", then "a = 2").
+ * The assignment has happened all the same, and so have the recomputations
+ * that succeeded; the variable whose formula failed keeps the value it had
+ * (and so do the variables computed only from it), and is listed in
+ * failures(), with the error, for the statement loops to say so
+ * separately, by name (see stale_report() in parser.h).
+ *
+ * The formulas live in an Arena of their own, one after the other, for as
+ * long as the Dependencies do; one that is replaced is just forgotten.
+ *
+ * A formula that has been recomputed often (hot_runs times) is compiled to
+ * machine code (see jit.h), which gives the same results faster; where
+ * there's no native code, it goes on being interpreted. So is a formula
+ * shorter than hot_size instructions: for "a+b", calling native code costs
+ * more than interpreting it. Native code computes in double, so the
+ * formulas of Basic_dependencies of any other type of number (see
+ * number.h) are always interpreted.
+ */
+#ifndef REACTIVE_H
+#define REACTIVE_H
+
+#include "../lib/std_lib_facilities.h"
+#include "arena.h"
+#include "code.h"
+#include "jit.h"
+#include "status.h"
+#include "symbol_table.h"
+
+template <class T> class Basic_dependencies {
+public:
+  // c (ending in define) has just been run: remember the formula
+  void declare(const Basic_code_view<T> &c);
+
+  // var has just been assigned to: recompute what depends on it, noting
+  // in failures() the variables whose formulas failed
+  void assigned(int var, Basic_symbol_table<T> &st);
+
+  struct Failure {
+    int var;      // which kept its old value ...
+    Calc_error e; // ... because its formula gave this
+  };
+  // those of the last assignment, in the order they were recomputed
+  const vector<Failure> &failures() const { return failed; }
+  void clear_failures() { failed.clear(); }
+
+private:
+  static constexpr int hot_runs = 8;
+  static constexpr int hot_size = 8;
+  static constexpr bool has_jit = is_same_v<T, double>;
+
+  struct Formula {
+    Basic_code_view<T> code{}; // without the define, in store
+    int order{-1};             // place in declaration order; -1: none
+    int runs{0};               // recomputations so far
+    Native_code native;
+  };
+  Arena store;
+  Jit_memory jit;
+  // both indexed by symbol id
+  vector<Formula> formulas;
+  vector<vector<int>> users; // variables whose formulas use this one
+
+  int declared{0};
+  vector<pair<int, int>> heap; // (order, id) of variables to recompute
+  vector<char> queued;         // by symbol id: is it on the heap
+  vector<Failure> failed;
+
+  void grow(int id);
+  void enqueue_users(int var);
+  Expected<T> recompute(Formula &f, Basic_symbol_table<T> &st);
+};
+
+using Dependencies = Basic_dependencies<double>;
+
+template <class T> void Basic_dependencies<T>::grow(int id) {
+  if (id >= int(formulas.size())) {
+    formulas.resize(id + 1);
+    users.resize(id + 1);
+    queued.resize(id + 1, false);
+  }
+}
+
+template <class T>
+void Basic_dependencies<T>::declare(const Basic_code_view<T> &c) {
+  const int n = c.size - 1;
+  const int var = c.code[n].arg;
+  grow(var);
+  Instruction *code = store.allocate<Instruction>(n);
+  copy(c.code, c.code + n, code);
+  T *constants = store.allocate<T>(c.nconstants);
+  copy(c.constants, c.constants + c.nconstants, constants);
+  formulas[var] = Formula{
+      Basic_code_view<T>{code, n, constants, c.nconstants, c.max_depth,
+                         c.pos},
+      declared++, 0, Native_code{}};
+
+  for (const Instruction *p = code; p != code + n; ++p)
+    if (p->op == Op::load) {
+      const Instruction &in = *p;
+      grow(in.arg);
+      vector<int> &u = users[in.arg];
+      if (u.empty() || u.back() != var) // "a*a" uses a once
+        u.push_back(var);
+    }
+}
+
+template <class T> void Basic_dependencies<T>::enqueue_users(int var) {
+  for (int u : users[var])
+    if (!queued[u] && formulas[u].order >= 0) {
+      queued[u] = true;
+      heap.push_back({formulas[u].order, u});
+      push_heap(heap.begin(), heap.end(), greater<>{});
+    }
+}
+
+// run f, natively once it is hot (where there is native code)
+template <class T>
+Expected<T> Basic_dependencies<T>::recompute(Formula &f,
+                                             Basic_symbol_table<T> &st) {
+  if constexpr (has_jit) {
+    if (++f.runs == hot_runs && f.code.size >= hot_size)
+      f.native.compile(f.code, st, jit);
+    return f.native.run(f.code, st);
+  } else {
+    return try_evaluate(f.code, st);
+  }
+}
+
+template <class T>
+void Basic_dependencies<T>::assigned(int var, Basic_symbol_table<T> &st) {
+  failed.clear();
+  if (var >= int(formulas.size()))
+    return; // nothing was ever computed from var
+  formulas[var] = Formula{};
+
+  enqueue_users(var);
+  while (!heap.empty()) {
+    pop_heap(heap.begin(), heap.end(), greater<>{});
+    const int u = heap.back().second;
+    heap.pop_back();
+    queued[u] = false;
+    Expected<T> r = recompute(formulas[u], st);
+    if (!r) {
+      failed.push_back(Failure{u, r.error()});
+      continue; // u hasn't changed, so neither has anything because of it
+    }
+    st.set(u, *r);
+    enqueue_users(u);
+  }
+}
+
+#endif // REACTIVE_H
@@ -0,0 +1,389 @@
+/*
+ * script_cache.h
+ *
+ * Compiled scripts kept on disk, so that a script that has been run before
+ * needn't be read and compiled again.
+ *
+ * Running a script is deterministic: the same text, in a fresh Session,
+ * always gives the same sequence of statements (the way the Token_stream
+ * recovers from an error depends on where, not when), with the same
+ * results. So calculate() can record the statements it compiles, in the
+ * order it runs them, and a later run of the same text can run the
+ * recorded code instead, without a Token_stream or a parser. The file
+ * holds
+ *   a Header: a magic string, the format version, and the size and hash of
+ *     the source,
+ *   the symbol table snapshot: every name the script uses, in symbol id
+ *     order, with the values of the constants (pi and e) the code was
+ *     compiled against,
+ *   the statements: for each, its instructions and constants, or the
+ *     error that kept it from compiling,
+ * laid out so that it can be used where it lies: the file is mapped into
+ * memory (mmap where there is one) and the instructions are run from the
+ * mapping. A file that is not for this source text, or not for this
+ * build, is just not used, and the code is checked when it is loaded, so
+ * that even a damaged file can't make try_evaluate() misbehave.
+ *
+ * Files are named after the hash of the source, in a cache directory; a
+ * new one is written to a temporary file and renamed into place, so that
+ * concurrent runs never see half a file.
+ */
+#ifndef SCRIPT_CACHE_H
+#define SCRIPT_CACHE_H
+
+#include "../lib/std_lib_facilities.h"
+#include "code.h"
+#include "mapped_file.h"
+#include "status.h"
+#include "symbol_table.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+// FNV-1a, 64 bits, over the whole source text
+inline uint64_t source_hash(const string &s) {
+  uint64_t h = 14695981039346656037ull;
+  for (char c : s) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+// where the compiled form of source with hash h lives in directory dir
+inline string cache_path(const string &dir, uint64_t h) {
+  ostringstream os;
+  os << dir << '/' << hex << setw(16) << setfill('0') << h << ".calc";
+  return os.str();
+}
+
+// the file format; all of it in the byte order of the machine
+namespace cache_format {
+
+constexpr char magic[8] = {'c', 'a', 'l', 'c', 'b', 'c', '\n', '\0'};
+constexpr uint32_t version = 1;
+constexpr uint32_t byte_order = 0x01020304;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t source_hash;
+  uint64_t source_size;
+  uint32_t names;
+  uint32_t statements;
+  uint64_t instructions;
+  uint64_t constants;
+  uint64_t name_chars; // the names' characters, at the end of the file
+};
+
+struct Name {
+  uint32_t size; // number of characters
+  uint8_t constant;
+  uint8_t pad[3];
+  double value; // for a constant
+};
+
+struct Statement {
+  int64_t pos;        // where it started in the source
+  uint32_t first;     // its instructions are instructions[first, +size)
+  uint32_t size;      // 0: it didn't compile; see error
+  uint32_t constants; // its constants start at constants[constants]
+  uint32_t nconstants;
+  int32_t max_depth;
+  int32_t error_id;
+  Errc error;      // why it didn't compile
+  bool starts_bad; // it began with a bad token (no "= " was written)
+  uint8_t pad[6];
+};
+
+static_assert(sizeof(Header) % 8 == 0 && sizeof(Name) % 8 == 0 &&
+                  sizeof(Statement) % 8 == 0 && sizeof(Instruction) == 8,
+              "the sections of a cache file stay 8-byte aligned");
+static_assert(is_trivially_copyable<Instruction>::value,
+              "instructions are written and mapped as they are");
+
+} // namespace cache_format
+
+/**
+ * What calculate() compiled, in the order it ran it; see calculate().
+ */
+class Script_recording {
+public:
+  void add(const Code &c);                        // a statement that compiled
+  void add(const Calc_error &e, bool starts_bad); // one that didn't
+
+  // something happened that replaying the code wouldn't reproduce
+  void spoil() { usable = false; }
+  bool is_usable() const { return usable; }
+
+  // write the recording, as the compiled form of source, to path; false if
+  // that isn't possible (the cache is only a cache)
+  bool save(const string &path, const string &source,
+            const Symbol_table &st) const;
+
+private:
+  vector<cache_format::Statement> statements;
+  vector<Instruction> instructions;
+  vector<double> constants;
+  bool usable{true};
+};
+
+inline void Script_recording::add(const Code &c) {
+  cache_format::Statement s{};
+  s.pos = c.pos;
+  s.first = instructions.size();
+  s.size = c.code.size();
+  s.constants = constants.size();
+  s.nconstants = c.constants.size();
+  s.max_depth = c.max_depth;
+  s.error_id = -1;
+  s.error = Errc::ok;
+  statements.push_back(s);
+  instructions.insert(instructions.end(), c.code.begin(), c.code.end());
+  constants.insert(constants.end(), c.constants.begin(), c.constants.end());
+}
+
+inline void Script_recording::add(const Calc_error &e, bool starts_bad) {
+  cache_format::Statement s{};
+  s.pos = e.pos;
+  s.error_id = e.id;
+  s.error = e.code;
+  s.starts_bad = starts_bad;
+  statements.push_back(s);
+}
+
+inline bool Script_recording::save(const string &path, const string &source,
+                                   const Symbol_table &st) const {
+  using namespace cache_format;
+  if (!usable)
+    return false;
+  Header h{};
+  memcpy(h.magic, magic, sizeof magic);
+  h.version = version;
+  h.byte_order = byte_order;
+  h.source_hash = source_hash(source);
+  h.source_size = source.size();
+  h.names = st.size();
+  h.statements = statements.size();
+  h.instructions = instructions.size();
+  h.constants = constants.size();
+  vector<Name> names;
+  string chars;
+  for (int id = 0; id < st.size(); ++id) {
+    Name n{};
+    n.size = st.name(id).size();
+    n.constant = st.is_constant(id);
+    n.value = n.constant ? st.get(id) : 0.0;
+    names.push_back(n);
+    chars += st.name(id);
+  }
+  h.name_chars = chars.size();
+
+  // a name no one else will pick: this thread, now
+  const string tmp =
+      path + ".tmp" +
+      to_string(hash<thread::id>{}(this_thread::get_id()) ^
+                chrono::steady_clock::now().time_since_epoch().count());
+  {
+    ofstream os{tmp, ios_base::binary};
+    if (!os)
+      return false;
+    auto put = [&os](const void *p, size_t n) {
+      os.write(static_cast<const char *>(p), n);
+    };
+    put(&h, sizeof h);
+    put(names.data(), names.size() * sizeof(Name));
+    put(statements.data(), statements.size() * sizeof(Statement));
+    put(instructions.data(), instructions.size() * sizeof(Instruction));
+    put(constants.data(), constants.size() * sizeof(double));
+    put(chars.data(), chars.size());
+    if (!os.flush()) {
+      os.close();
+      remove(tmp.c_str());
+      return false;
+    }
+  }
+  if (rename(tmp.c_str(), path.c_str()) != 0) {
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+/**
+ * A compiled script loaded from the cache, ready to be replayed; see
+ * replay() in calculator.h.
+ */
+class Cached_script {
+public:
+  // load the compiled form of source from path; false if there is none
+  // that can be trusted
+  bool load(const string &path, const string &source);
+
+  // intern the script's names in st, a fresh Session's table, so that the
+  // symbol ids in the code mean what they meant; false if they can't
+  bool restore(Symbol_table &st) const;
+
+  int size() const { return header->statements; }
+  const cache_format::Statement &statement(int i) const {
+    return statements[i];
+  }
+  Code_view code(int i) const;
+
+private:
+  unique_ptr<Mapped_file> file;
+  const cache_format::Header *header{nullptr};
+  const cache_format::Name *names{nullptr};
+  const cache_format::Statement *statements{nullptr};
+  const Instruction *instructions{nullptr};
+  const double *constants{nullptr};
+  const char *chars{nullptr};
+
+  bool check() const;
+};
+
+inline Code_view Cached_script::code(int i) const {
+  const cache_format::Statement &s = statements[i];
+  return Code_view{instructions + s.first, int(s.size),
+                   constants + s.constants, int(s.nconstants),
+                   s.max_depth, s.pos};
+}
+
+inline bool Cached_script::load(const string &path, const string &source) {
+  using namespace cache_format;
+  header = nullptr;
+  file = make_unique<Mapped_file>(path);
+  const size_t n = file->size();
+  const char *p = file->data();
+  if (n < sizeof(Header))
+    return false;
+  const Header *h = reinterpret_cast<const Header *>(p);
+  if (memcmp(h->magic, magic, sizeof magic) != 0 || h->version != version ||
+      h->byte_order != byte_order || h->source_size != source.size() ||
+      h->source_hash != source_hash(source))
+    return false;
+
+  // the sections must fill the file exactly (and the counts can't be so
+  // large that adding them up overflows)
+  if (h->instructions > n || h->constants > n || h->name_chars > n)
+    return false;
+  const size_t need = sizeof(Header) + h->names * sizeof(Name) +
+                      h->statements * sizeof(Statement) +
+                      h->instructions * sizeof(Instruction) +
+                      h->constants * sizeof(double) + h->name_chars;
+  if (need != n)
+    return false;
+  p += sizeof(Header);
+  names = reinterpret_cast<const Name *>(p);
+  p += h->names * sizeof(Name);
+  statements = reinterpret_cast<const Statement *>(p);
+  p += h->statements * sizeof(Statement);
+  instructions = reinterpret_cast<const Instruction *>(p);
+  p += h->instructions * sizeof(Instruction);
+  constants = reinterpret_cast<const double *>(p);
+  p += h->constants * sizeof(double);
+  chars = p;
+  header = h;
+  if (!check()) {
+    header = nullptr;
+    return false;
+  }
+  return true;
+}
+
+// is every statement code that try_evaluate() can run safely: operands in
+// range, and a stack that never underflows and is exactly max_depth deep
+// at its deepest?
+inline bool Cached_script::check() const {
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < header->names; ++i)
+    total += names[i].size;
+  if (total != header->name_chars)
+    return false;
+
+  const long nnames = header->names;
+  for (int i = 0; i < size(); ++i) {
+    const cache_format::Statement &s = statements[i];
+    uint8_t starts_bad; // a bool only if it is 0 or 1
+    memcpy(&starts_bad, &s.starts_bad, 1);
+    if (starts_bad > 1)
+      return false;
+    if (s.size == 0) { // an error: the message must make sense
+      if (s.error <= Errc::ok || s.error > Errc::assign_constant ||
+          s.error_id < -1 || s.error_id >= nnames)
+        return false;
+      continue;
+    }
+    if (s.first > header->instructions ||
+        s.size > header->instructions - s.first ||
+        s.constants > header->constants ||
+        s.nconstants > header->constants - s.constants)
+      return false;
+    int depth = 0;
+    int deepest = 0;
+    for (const Instruction *in = instructions + s.first;
+         in != instructions + s.first + s.size; ++in) {
+      switch (in->op) {
+      case Op::number:
+        if (in->arg < 0 || uint32_t(in->arg) >= s.nconstants)
+          return false;
+        ++depth;
+        break;
+      case Op::load:
+        if (in->arg < 0 || in->arg >= nnames)
+          return false;
+        ++depth;
+        break;
+      case Op::negate:
+        if (depth < 1)
+          return false;
+        break;
+      case Op::add:
+      case Op::sub:
+      case Op::mul:
+      case Op::div:
+      case Op::mod:
+        if (depth < 2)
+          return false;
+        --depth;
+        break;
+      case Op::define:
+      case Op::assign:
+        if (depth < 1 || in->arg < 0 || in->arg >= nnames)
+          return false;
+        break;
+      default:
+        return false;
+      }
+      deepest = max(deepest, depth);
+    }
+    // max_depth sizes the stack, so it must be what the code needs: not
+    // less, and not (say) a billion more
+    if (depth != 1 || deepest != s.max_depth)
+      return false;
+  }
+  return true;
+}
+
+inline bool Cached_script::restore(Symbol_table &st) const {
+  if (!header)
+    return false;
+  const char *p = chars;
+  for (uint32_t id = 0; id < header->names; ++id) {
+    const cache_format::Name &n = names[id];
+    if (st.intern(string_view(p, n.size)) != int(id))
+      return false;
+    p += n.size;
+    // the constants must be those the code was compiled (and folded) with,
+    // and nothing else may be declared yet
+    if (n.constant ? !st.is_constant(id) || st.get(id) != n.value
+                   : st.is_declared(id))
+      return false;
+  }
+  return st.size() == int(header->names);
+}
+
+#endif // SCRIPT_CACHE_H
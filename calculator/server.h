@@ -0,0 +1,329 @@
+/*
+ * server.h
+ *
+ * The calculator as a long-running server: statements come in over a
+ * socket (Unix or TCP) and results go back, "= value" per statement, or
+ * the error message.
+ *
+ * Every connection has a Session of its own, so its variables are its own;
+ * each starts from a copy of the table of constants, which is built just
+ * once (see session.h), so a new connection costs no more than a Session:
+ * copying a few short vectors. A server computes in one type of number
+ * (see number.h) for all of them.
+ *
+ * One thread serves all the connections from an epoll loop. Whatever has
+ * arrived on a connection is run as one batch: every complete statement in
+ * it (up to the last ';') is run, and the replies are sent with a single
+ * write. The rest waits for more input. The statements see exactly the
+ * tokens they would have seen on cin, including the way a statement that
+ * fails is skipped up to the next ';', even if that ';' comes in a later
+ * batch. A quit ("q") ends the connection; so does the client's closing its
+ * end, after what it sent has been run.
+ *
+ * No client can keep the others waiting: each time a connection is
+ * served, at most max_reads reads' worth of its input is run, and whatever
+ * more there is waits for the loop to come round again (the events are
+ * level-triggered, so epoll reports it again). Nor can a client that
+ * doesn't read its replies make the server hold on to them without end:
+ * once more than max_unsent bytes of replies are waiting to be sent, the
+ * connection's input isn't read until they have gone.
+ *
+ * The event loop needs Linux (epoll); Connection, which does the work,
+ * doesn't.
+ */
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "../lib/std_lib_facilities.h"
+#include "output.h"
+#include "parser.h"
+#include "session.h"
+
+/**
+ * The calculator's side of one connection: statements go in as the bytes
+ * arrive, replies come out. Its Session computes in Ts.
+ */
+template <class T> class Basic_connection {
+public:
+  explicit Basic_connection(const Run_options &o = {})
+      : s{in, Token_stream::Mode::block} {
+    o.apply(s);
+  }
+
+  static constexpr size_t max_pending = 1 << 20; // bytes without a ';'
+
+  // bytes [p, p+n) arrived: run the statements they complete, appending
+  // the replies to out; false if a quit ended the session
+  bool receive(const char *p, size_t n, string &out);
+
+  // the client has sent all it will: run what is left
+  void finish(string &out);
+
+  bool too_long() const { return pending.size() > max_pending; }
+
+private:
+  istringstream in; // what the Session reads: the current batch
+  Basic_session<T> s;
+  Basic_code<T> c;
+  string pending;       // received but not yet run: no ';' after it
+  long fed{0};          // number of characters given to the Session so far
+  bool skipping{false}; // skipping what's left of a failed statement
+
+  bool run(string batch, string &out);
+};
+
+using Connection = Basic_connection<double>;
+
+template <class T>
+bool Basic_connection<T>::receive(const char *p, size_t n, string &out) {
+  const char *q = p + n; // just after the last ';' that arrived
+  while (q != p && q[-1] != print)
+    --q;
+  if (q == p) { // no statement is complete yet
+    pending.append(p, n);
+    return true;
+  }
+  string batch = move(pending);
+  batch.append(p, q);
+  pending.assign(q, p + n);
+  return run(move(batch), out);
+}
+
+template <class T> void Basic_connection<T>::finish(string &out) {
+  string batch;
+  swap(batch, pending);
+  run(move(batch), out);
+}
+
+// run each statement in batch; the Session reads it as if it came after
+// everything fed before, and finds the end of its input at its end
+template <class T>
+bool Basic_connection<T>::run(string batch, string &out) {
+  fed += batch.size();
+  in.clear();
+  in.str(move(batch));
+
+  ostringstream os;
+  bool open = true;
+  {
+    Output o{os};
+    if (skipping)
+      skipping = !s.ts.ignore(print);
+    while (!skipping) {
+      while (s.ts.peek().kind == print)
+        s.ts.get(); // eat ';'
+      if (s.ts.peek().kind == quit) {
+        open = s.ts.next_position() == fed; // the end of the batch, not "q"
+        s.ts.get();
+        break;
+      }
+      Expected<T> r = try_statement(s, c);
+      if (r) {
+        o.put(result);
+        o.put(*r);
+        o.put('\n');
+        o.put(stale_report(s));
+      } else {
+        o.put(message(r.error(), s.names));
+        o.put('\n');
+        skipping = !s.ts.ignore(print); // the rest may be yet to come
+      }
+    }
+  }
+  out += os.str();
+  return open;
+}
+
+#ifdef __linux__
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// a listening socket for address: a path (anything with a '/' in it) for a
+// Unix socket, otherwise [host:]port for TCP (host defaults to 127.0.0.1)
+inline int listen_on(const string &address) {
+  int fd;
+  if (address.find('/') != string::npos) {
+    sockaddr_un sa{};
+    sa.sun_family = AF_UNIX;
+    if (address.size() >= sizeof sa.sun_path)
+      error("serve: socket path too long: ", address);
+    strcpy(sa.sun_path, address.c_str());
+    struct stat sb;
+    if (stat(sa.sun_path, &sb) == 0 && S_ISSOCK(sb.st_mode))
+      unlink(sa.sun_path); // left over from an earlier server
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&sa), sizeof sa) < 0)
+      error("serve: can't bind ", address + ": " + strerror(errno));
+  } else {
+    const size_t colon = address.rfind(':');
+    const string host =
+        colon == string::npos ? "127.0.0.1" : address.substr(0, colon);
+    const string port =
+        colon == string::npos ? address : address.substr(colon + 1);
+    sockaddr_in sa{};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(stoi(port));
+    if (inet_pton(AF_INET, host.c_str(), &sa.sin_addr) != 1)
+      error("serve: bad address ", address);
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    const int on = 1;
+    if (fd >= 0)
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&sa), sizeof sa) < 0)
+      error("serve: can't bind ", address + ": " + strerror(errno));
+  }
+  if (listen(fd, SOMAXCONN) < 0)
+    error("serve: can't listen on ", address + ": " + strerror(errno));
+  return fd;
+}
+
+// serve connections on address, each Session computing in Ts as o says,
+// until the process is killed
+template <class T>
+void serve(const string &address, const Run_options &o = {}) {
+  constexpr int max_reads = 4;            // per connection, per event
+  constexpr size_t max_unsent = 1 << 20; // replies before reading stops
+  struct Client {
+    explicit Client(const Run_options &o) : calc{o} {}
+    Basic_connection<T> calc;
+    string out;          // replies not yet sent
+    bool closing{false}; // close once out has been sent
+    bool writing{false}; // waiting for room to send out
+    bool reading{true};  // is its input watched for
+  };
+  unordered_map<int, unique_ptr<Client>> clients;
+
+  const int listener = listen_on(address);
+  const int ep = epoll_create1(0);
+  if (ep < 0)
+    error("serve: epoll_create1: ", strerror(errno));
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.fd = listener;
+  epoll_ctl(ep, EPOLL_CTL_ADD, listener, &ev);
+
+  // watch fd for room to send (writing), and for input unless its replies
+  // have piled up
+  auto watch = [ep](int fd, Client &cl, bool writing) {
+    const bool reading = cl.out.size() <= max_unsent;
+    if (cl.writing == writing && cl.reading == reading)
+      return;
+    cl.writing = writing;
+    cl.reading = reading;
+    epoll_event ev{};
+    ev.events = (reading ? EPOLLIN : 0u) | (writing ? EPOLLOUT : 0u);
+    ev.data.fd = fd;
+    epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
+  };
+  auto drop = [&clients](int fd) {
+    close(fd); // which takes it out of the epoll set too
+    clients.erase(fd);
+  };
+  // send what we can; returns false once the client is gone (or done)
+  auto send_some = [&](int fd, Client &cl) {
+    while (!cl.out.empty()) {
+      const ssize_t n =
+          send(fd, cl.out.data(), cl.out.size(), MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          watch(fd, cl, true);
+          return true;
+        }
+        drop(fd);
+        return false;
+      }
+      cl.out.erase(0, n);
+    }
+    if (cl.closing) {
+      drop(fd);
+      return false;
+    }
+    watch(fd, cl, false);
+    return true;
+  };
+
+  constexpr int max_events = 64;
+  epoll_event events[max_events];
+  vector<char> buf(64 * 1024);
+  while (true) {
+    const int n = epoll_wait(ep, events, max_events, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      error("serve: epoll_wait: ", strerror(errno));
+    }
+    for (int i = 0; i < n; ++i) {
+      const int fd = events[i].data.fd;
+      if (fd == listener) {
+        int c;
+        while ((c = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+          clients[c] = make_unique<Client>(o);
+          epoll_event ev{};
+          ev.events = EPOLLIN;
+          ev.data.fd = c;
+          epoll_ctl(ep, EPOLL_CTL_ADD, c, &ev);
+        }
+        continue;
+      }
+      auto p = clients.find(fd);
+      if (p == clients.end())
+        continue;
+      Client &cl = *p->second;
+      if (events[i].events & EPOLLOUT) {
+        if (!send_some(fd, cl))
+          continue;
+      }
+      if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) || cl.closing)
+        continue;
+
+      // what has arrived, a read at a time, up to max_reads of them, and
+      // for as long as the replies don't pile up
+      bool more = true;
+      for (int reads = 0; reads < max_reads && cl.out.size() <= max_unsent;) {
+        const ssize_t got = read(fd, buf.data(), buf.size());
+        if (got > 0) {
+          if (!cl.calc.receive(buf.data(), got, cl.out)) {
+            cl.closing = true; // quit
+            break;
+          }
+          if (cl.calc.too_long()) {
+            cl.out += "statement too long\n";
+            cl.closing = true;
+            break;
+          }
+          ++reads;
+          continue;
+        }
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+          break;
+        if (got < 0 && errno == EINTR)
+          continue;
+        more = false; // the client is done (or gone)
+        break;
+      }
+      if (!more && !cl.closing) {
+        cl.calc.finish(cl.out);
+        cl.closing = true;
+      }
+      send_some(fd, cl);
+    }
+  }
+}
+
+#else
+
+template <class T> void serve(const string &, const Run_options & = {}) {
+  error("serve: the server needs epoll (Linux)");
+}
+
+#endif // __linux__
+
+#endif // SERVER_H
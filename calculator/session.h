@@ -0,0 +1,94 @@
+/*
+ * session.h
+ *
+ * A Session is one run of the calculator: the input it reads statements
+ * from and the variables those statements declare. Sessions share
+ * nothing, so any number of them can run at the same time, on different
+ * threads: each starts from a copy of the table of constants, which is
+ * built (pi and e read) just once, and never changed.
+ *
+ * A Basic_session computes with numbers of type T (see number.h): its
+ * literals, its variables and its results are all Ts. A Session is the
+ * Basic_session of doubles.
+ */
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "../lib/std_lib_facilities.h"
+#include "arena.h"
+#include "memo.h"
+#include "number.h"
+#include "numbers.h"
+#include "reactive.h"
+#include "symbol_table.h"
+#include "token_stream.h"
+
+template <class T> class Basic_session {
+public:
+  explicit Basic_session(istream &is = cin,
+                         Token_stream::Mode m = Token_stream::Mode::line);
+  explicit Basic_session(string_view all); // the input, all in memory
+  explicit Basic_session(Token_source &src); // tokens scanned elsewhere
+
+  Basic_symbol_table<T> names; // the variables; initialized before ts
+  Token_stream ts;             // provides get() and putback()
+
+  // memory for the temporaries of compiling one statement; reset when the
+  // next one is compiled
+  Arena scratch;
+
+  bool reactive{false};               // do declared variables follow their
+  Basic_dependencies<T> dependencies; // inputs, and if so, what they follow
+
+  bool memoize{false};      // are subexpressions' values kept for later
+  Basic_memo_cache<T> memo; // ... and if so, there (see memo.h)
+};
+
+using Session = Basic_session<double>;
+
+/**
+ * What main's flags say about running a Session, for the Sessions made
+ * elsewhere: one per file (see driver.h), one per connection (see
+ * server.h).
+ */
+struct Run_options {
+  bool prompts{true};   // calculate() rather than calculate_unprompted()
+  bool reactive{false}; // as Basic_session::reactive
+  bool memoize{false};  // as Basic_session::memoize
+  Precision precision{Precision::float64}; // which Basic_session, in main()
+
+  template <class T> void apply(Basic_session<T> &s) const {
+    s.reactive = reactive;
+    s.memoize = memoize;
+  }
+};
+
+// the constants every session of Ts starts out knowing: pi and e
+template <class T> const Basic_symbol_table<T> &constants() {
+  static const Basic_symbol_table<T> t = [] {
+    Basic_symbol_table<T> t;
+    define_constant(t, "pi", parse_literal<T>("3.1415926535"));
+    define_constant(t, "e", parse_literal<T>("2.7182818284"));
+    return t;
+  }();
+  return t;
+}
+
+template <class T>
+Basic_session<T>::Basic_session(istream &is, Token_stream::Mode m)
+    : names{constants<T>()}, ts{names, is, m} {
+  ts.set_wide(wider_than_double<T>);
+}
+
+template <class T>
+Basic_session<T>::Basic_session(string_view all)
+    : names{constants<T>()}, ts{names, all} {
+  ts.set_wide(wider_than_double<T>);
+}
+
+// the literals are read (wide, or not) where the tokens are scanned
+template <class T>
+Basic_session<T>::Basic_session(Token_source &src)
+    : names{constants<T>()}, ts{names, src} {}
+
+#endif // SESSION_H
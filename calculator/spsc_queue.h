@@ -0,0 +1,149 @@
+/*
+ * spsc_queue.h
+ *
+ * A bounded queue between exactly one producer thread and one consumer
+ * thread, without locks (unless a side has to sleep).
+ *
+ * The elements sit in a ring of slots. The producer alone writes the tail
+ * and the consumer alone writes the head, each with release ordering after
+ * touching a slot, and each reads the other's index with acquire ordering
+ * before touching one; while neither side waits, that is all the
+ * synchronization there is. The two indexes (and each side's cached copy
+ * of the other's) are on cache lines of their own, so the threads don't
+ * fight over a line just to pass elements.
+ *
+ * Elements are swapped in and out of their slots rather than copied: the
+ * producer gets back what the consumer left in the slot, so an element
+ * that owns memory (a Code, say) has it recycled rather than reallocated.
+ *
+ * A side that finds the queue full (or empty) spins for a while, yields
+ * for a while longer, and then sleeps on a condition variable until there
+ * is room (an element), or the stop flag is set (and wake() called); so a
+ * stage waiting on a slow pipe, or a terminal, costs no CPU. Passing an
+ * element costs each side a fence besides, to see whether the other one
+ * sleeps, and the mutex only if it does.
+ */
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include "../lib/std_lib_facilities.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+template <class T> class Spsc_queue {
+public:
+  // room for capacity elements; capacity must be a power of two
+  explicit Spsc_queue(int capacity) : slots(capacity), mask{capacity - 1} {
+    if (capacity <= 0 || (capacity & mask) != 0)
+      error("Spsc_queue: capacity must be a power of two");
+  }
+
+  Spsc_queue(const Spsc_queue &) = delete;
+  Spsc_queue &operator=(const Spsc_queue &) = delete;
+
+  // producer: swap v into the queue (v gets what was in the slot); waits
+  // for room, and gives up (false) if stop is set while it waits (see
+  // wake())
+  bool push(T &v, const atomic<bool> &stop);
+
+  // consumer: swap the next element into v; waits for one, and gives up
+  // (false) if stop is set while it waits (see wake())
+  bool pop(T &v, const atomic<bool> &stop);
+
+  // either side: a stop flag has been set, so whoever sleeps should look
+  void wake();
+
+private:
+  static constexpr int spins = 64;   // before yielding ...
+  static constexpr int yields = 1024; // ... and then before sleeping
+
+  mutex m; // for sleeping on ...
+  condition_variable cv;
+  atomic<bool> producer_sleeps{false}; // ... by the side that does
+  atomic<bool> consumer_sleeps{false};
+
+  vector<T> slots;
+  const long mask;
+
+  alignas(64) atomic<long> tail{0}; // written by the producer ...
+  long head_seen{0};                // ... which last saw head here
+  alignas(64) atomic<long> head{0}; // written by the consumer ...
+  long tail_seen{0};                // ... which last saw tail here
+
+  template <class F>
+  void sleep(atomic<bool> &sleeps, F ready, const atomic<bool> &stop);
+  void woken(const atomic<bool> &sleeps);
+};
+
+// sleep, saying so in sleeps, until ready() or stop; the fence, and the one
+// in woken(), make sure that either we see what the other side has done,
+// or it sees that we sleep (and wakes us, under m)
+template <class T>
+template <class F>
+void Spsc_queue<T>::sleep(atomic<bool> &sleeps, F ready,
+                          const atomic<bool> &stop) {
+  unique_lock<mutex> l{m};
+  sleeps.store(true, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  cv.wait(l, [&] { return ready() || stop.load(memory_order_relaxed); });
+  sleeps.store(false, memory_order_relaxed);
+}
+
+// the index the other side waits on has just moved: wake it if it sleeps
+template <class T> void Spsc_queue<T>::woken(const atomic<bool> &sleeps) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (sleeps.load(memory_order_relaxed)) {
+    lock_guard<mutex> g{m};
+    cv.notify_one();
+  }
+}
+
+template <class T> void Spsc_queue<T>::wake() {
+  { lock_guard<mutex> g{m}; }
+  cv.notify_all();
+}
+
+template <class T> bool Spsc_queue<T>::push(T &v, const atomic<bool> &stop) {
+  const long t = tail.load(memory_order_relaxed);
+  for (int n = 0; t - head_seen > mask; ++n) {
+    head_seen = head.load(memory_order_acquire);
+    if (t - head_seen <= mask)
+      break;
+    if (stop.load(memory_order_relaxed))
+      return false;
+    if (n >= spins + yields)
+      sleep(producer_sleeps,
+            [&] { return t - head.load(memory_order_acquire) <= mask; },
+            stop);
+    else if (n >= spins)
+      this_thread::yield();
+  }
+  swap(slots[t & mask], v);
+  tail.store(t + 1, memory_order_release);
+  woken(consumer_sleeps);
+  return true;
+}
+
+template <class T> bool Spsc_queue<T>::pop(T &v, const atomic<bool> &stop) {
+  const long h = head.load(memory_order_relaxed);
+  for (int n = 0; h == tail_seen; ++n) {
+    tail_seen = tail.load(memory_order_acquire);
+    if (h != tail_seen)
+      break;
+    if (stop.load(memory_order_relaxed))
+      return false;
+    if (n >= spins + yields)
+      sleep(consumer_sleeps,
+            [&] { return tail.load(memory_order_acquire) != h; }, stop);
+    else if (n >= spins)
+      this_thread::yield();
+  }
+  swap(slots[h & mask], v);
+  head.store(h + 1, memory_order_release);
+  woken(producer_sleeps);
+  return true;
+}
+
+#endif // SPSC_QUEUE_H
@@ -0,0 +1,218 @@
+/*
+ * stats.h
+ *
+ * Counting what the calculator does, to see where the time goes.
+ *
+ * Built with CALC_STATS defined, the hot paths count into a Stats of their
+ * own thread (so counting takes no locks and shares no cache lines):
+ *   tokens scanned, by kind, and putback() calls,
+ *   symbol table lookups, how many found the name, and the slots probed,
+ *   failed statements, by Errc,
+ * and time lexing, parsing and evaluating, in ticks of the cheapest clock
+ * there is (the time stamp counter on x86). A span is timed exclusively:
+ * the lexing done while parsing is counted as lexing, not twice.
+ *
+ * A thread's counts are added to the process's when it ends, and
+ * report_stats() writes those plus the calling thread's.
+ *
+ * Without CALC_STATS the CALC_ macros expand to nothing: the counting
+ * costs nothing at all. Include this before anything it counts in; it
+ * depends on nothing else of the calculator's.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include "../lib/std_lib_facilities.h"
+#include <chrono>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+struct Stats {
+  static constexpr int nkinds = 128; // Token kinds are ASCII characters
+  static constexpr int nerrors = 16; // at least as many as Errcs
+
+  long tokens[nkinds]{};
+  long putbacks{0};
+  long lookups{0};     // Symbol_table::intern() and find()
+  long lookup_hits{0}; // ... that found the name there already
+  long probe_steps{0}; // slots looked at by those lookups
+  long errors[nerrors]{};
+
+  enum Span { lexing, parsing, evaluation, nspans };
+  long long ticks[nspans]{};
+
+  void add(const Stats &s);
+};
+
+inline void Stats::add(const Stats &s) {
+  for (int i = 0; i < nkinds; ++i)
+    tokens[i] += s.tokens[i];
+  putbacks += s.putbacks;
+  lookups += s.lookups;
+  lookup_hits += s.lookup_hits;
+  probe_steps += s.probe_steps;
+  for (int i = 0; i < nerrors; ++i)
+    errors[i] += s.errors[i];
+  for (int i = 0; i < nspans; ++i)
+    ticks[i] += s.ticks[i];
+}
+
+// the counts of threads that have ended
+inline Stats &finished_stats() {
+  static Stats s;
+  return s;
+}
+
+inline mutex &stats_lock() {
+  static mutex m;
+  return m;
+}
+
+// the calling thread's counts; added to finished_stats() when it ends
+inline Stats &stats() {
+  struct Local {
+    Stats counts;
+    ~Local() {
+      lock_guard<mutex> g{stats_lock()};
+      finished_stats().add(counts);
+    }
+  };
+  thread_local Local local;
+  return local.counts;
+}
+
+inline long long stats_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+/**
+ * Times a span (of lexing, parsing, ...) from construction to destruction,
+ * less the time of the spans inside it, and counts it in stats().
+ */
+class Stats_span {
+public:
+  explicit Stats_span(Stats::Span s)
+      : span{s}, outer{current()}, start{stats_ticks()} {
+    current() = this;
+  }
+  ~Stats_span() {
+    const long long t = stats_ticks() - start;
+    stats().ticks[span] += t - inner;
+    if (outer)
+      outer->inner += t;
+    current() = outer;
+  }
+
+  Stats_span(const Stats_span &) = delete;
+  Stats_span &operator=(const Stats_span &) = delete;
+
+private:
+  Stats::Span span;
+  Stats_span *outer;
+  long long start;
+  long long inner{0}; // ticks of the spans inside this one
+
+  static Stats_span *&current() {
+    thread_local Stats_span *p = nullptr;
+    return p;
+  }
+};
+
+#ifdef CALC_STATS
+#define CALC_COUNT(field) (++stats().field)
+#define CALC_COUNT_TOKEN(kind) (++stats().tokens[(kind) & 0x7f])
+#define CALC_COUNT_ERROR(code) (++stats().errors[int(code)])
+#define CALC_SPAN(span) Stats_span calc_span_{Stats::span}
+#else
+#define CALC_COUNT(field) ((void)0)
+#define CALC_COUNT_TOKEN(kind) ((void)0)
+#define CALC_COUNT_ERROR(code) ((void)0)
+#define CALC_SPAN(span) ((void)0)
+#endif
+
+// the names of the Errcs (see status.h), in order, for the report
+const char *const errc_names[] = {
+    "ok",
+    "bad_token",
+    "primary_expected",
+    "rparen_expected",
+    "name_expected",
+    "equal_expected",
+    "divide_by_zero",
+    "mod_by_zero",
+    "undefined_variable",
+    "declared_twice",
+    "assign_undefined",
+    "assign_constant",
+};
+
+inline string token_kind_name(char k) {
+  switch (k) {
+  case '8':
+    return "number";
+  case 'a':
+    return "name";
+  case 'L':
+    return "let";
+  case 'q':
+    return "quit";
+  case '?':
+    return "bad";
+  default:
+    return string(1, k);
+  }
+}
+
+// write the counts of this thread and of the threads that have ended
+inline void report_stats(ostream &os) {
+#ifndef CALC_STATS
+  os << "no statistics: built without CALC_STATS\n";
+#else
+  Stats s;
+  {
+    lock_guard<mutex> g{stats_lock()};
+    s = finished_stats();
+  }
+  s.add(stats());
+
+  long tokens = 0;
+  for (long n : s.tokens)
+    tokens += n;
+  os << "tokens      " << setw(14) << tokens << '\n';
+  for (int k = 0; k < Stats::nkinds; ++k)
+    if (s.tokens[k])
+      os << "  " << left << setw(10) << token_kind_name(k) << right
+         << setw(14) << s.tokens[k] << '\n';
+  os << "putbacks    " << setw(14) << s.putbacks << '\n';
+  os << "lookups     " << setw(14) << s.lookups << "  hits " << s.lookup_hits
+     << "  probes " << s.probe_steps << '\n';
+
+  long errors = 0;
+  for (long n : s.errors)
+    errors += n;
+  os << "errors      " << setw(14) << errors << '\n';
+  for (int e = 0; e < Stats::nerrors; ++e)
+    if (s.errors[e])
+      os << "  " << left << setw(18) << errc_names[e] << right
+         << setw(6) << s.errors[e] << '\n';
+
+  const char *spans[] = {"lexing", "parsing", "evaluation"};
+  long long total = 0;
+  for (long long t : s.ticks)
+    total += t;
+  for (int i = 0; i < Stats::nspans; ++i)
+    os << left << setw(12) << spans[i] << right << setw(14) << s.ticks[i]
+       << " ticks" << setw(7) << fixed << setprecision(1)
+       << (total ? 100.0 * s.ticks[i] / total : 0.0) << "%\n"
+       << defaultfloat;
+#endif
+}
+
+#endif // STATS_H
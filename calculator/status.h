@@ -0,0 +1,97 @@
+/*
+ * status.h
+ *
+ * Reporting errors without throwing.
+ *
+ * The parser and evaluate() say what went wrong by returning a Calc_error:
+ * a code, the place in the input where it went wrong and, for errors about
+ * a variable, which one. Nothing is formatted and nothing is thrown, so a
+ * bad statement costs about as much as a good one. message() turns a
+ * Calc_error into the same text error() has always thrown; the throwing
+ * functions (statement(), evaluate(), ...) do exactly that.
+ */
+#ifndef STATUS_H
+#define STATUS_H
+
+#include "../lib/std_lib_facilities.h"
+#include "stats.h"
+#include "symbol_table.h"
+
+enum class Errc : char {
+  ok,
+  bad_token,          // input that doesn't make a Token
+  primary_expected,   // e.g. "2*;"
+  rparen_expected,    // "(" without ")"
+  name_expected,      // "let" not followed by a name
+  equal_expected,     // "let x" not followed by "="
+  divide_by_zero,     // x/0
+  mod_by_zero,        // x%0
+  undefined_variable, // use of a name that was never declared
+  declared_twice,     // "let" of a name that already has a value
+  assign_undefined,   // "x = 1" before x has been declared
+  assign_constant,    // "pi = 3"
+};
+
+static_assert(size(errc_names) == size_t(Errc::assign_constant) + 1 &&
+                  size(errc_names) <= Stats::nerrors,
+              "stats.h knows every Errc");
+
+struct Calc_error {
+  Errc code{Errc::ok};
+  long pos{0}; // offset in the input of the token (or statement) at fault
+  int id{-1};  // symbol id of the variable the error is about, if any
+
+  bool ok() const { return code == Errc::ok; }
+};
+
+// the text error() would have thrown for e
+inline string message(const Calc_error &e, const Symbol_names &st) {
+  switch (e.code) {
+  case Errc::ok:
+    return "no error";
+  case Errc::bad_token:
+    return "Bad token";
+  case Errc::primary_expected:
+    return "primary expected";
+  case Errc::rparen_expected:
+    return "')' expected";
+  case Errc::name_expected:
+    return "name expected in declaration";
+  case Errc::equal_expected:
+    return "= missing in declartion of " + st.name(e.id);
+  case Errc::divide_by_zero:
+    return "divide by zero";
+  case Errc::mod_by_zero:
+    return "%:divide by zero";
+  case Errc::undefined_variable:
+    return "get: undefined variable " + st.name(e.id);
+  case Errc::declared_twice:
+    return st.name(e.id) + " declared twice";
+  case Errc::assign_undefined:
+    return "set: undefined variable " + st.name(e.id);
+  case Errc::assign_constant:
+    return "set: can't assign to constant " + st.name(e.id);
+  }
+  return "unknown error";
+}
+
+/**
+ * Either a value or the Calc_error that prevented computing it, in the
+ * manner of std::expected.
+ */
+template <class T> class Expected {
+public:
+  Expected(T v) : val{v} {}
+  Expected(Calc_error e) : err{e} {}
+
+  explicit operator bool() const { return err.ok(); } // is there a value
+  const T &operator*() const { return val; }
+  const T &value() const { return val; }
+  const Calc_error &error() const { return err; }
+
+private:
+  T val{};
+  Calc_error err;
+};
+
+#endif // STATUS_H
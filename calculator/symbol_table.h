@@ -0,0 +1,263 @@
+/*
+ * symbol_table.h
+ *
+ * The calculator's table of variables.
+ *
+ * Names are interned: every distinct name is stored exactly once and is
+ * identified by a small integer (its symbol id) from then on. The names are
+ * found through an open-addressing hash index (linear probing, power-of-two
+ * capacity), so a lookup costs one hash and, on average, a single string
+ * comparison no matter how many variables have been declared.
+ *
+ * A name can be interned without being declared; that lets the Token_stream
+ * hand out symbol ids for names the program has not seen a "let" for yet.
+ * Names are looked up as string_views, straight from wherever they are
+ * (the Token_stream's buffer, say), so finding a name allocates nothing;
+ * only a new name is copied, or moved, into the table.
+ *
+ * A variable can be declared constant (like pi and e). Its value can then
+ * never change, so compiled code may use the value instead of the variable.
+ *
+ * The table is kept as parallel arrays indexed by symbol id: the names in
+ * one, the values in another, the flags in a third. Evaluation reads only
+ * values (and flags), so it touches one number per variable rather than a
+ * whole string.
+ *
+ * The names (and flags) are a Symbol_names, which is all the Token_stream
+ * needs; a Basic_symbol_table adds the values, as numbers of type T (see
+ * number.h), and a Symbol_table is the Basic_symbol_table of doubles. The
+ * values are kept for the symbol ids up to the last declared one.
+ *
+ * Every variable also has a generation, which changes whenever the
+ * variable gets a value, so a value computed from some variables can be
+ * known to be still good by their generations alone (see memo.h).
+ */
+#ifndef SYMBOL_TABLE_H
+#define SYMBOL_TABLE_H
+
+#include "../lib/std_lib_facilities.h"
+#include "stats.h"
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+class Symbol_names {
+public:
+  Symbol_names() : slots(initial_capacity, Slot{0, empty}) {}
+
+  int intern(string_view s); // symbol id of s; add s if not there
+  int intern(string &&s);    // ... moving s in if it is added
+  int intern(const char *s) { return intern(string_view{s}); }
+  int find(string_view s) const; // symbol id of s, or -1
+
+  const string &name(int id) const { return names[id]; }
+  bool is_declared(int id) const { return flags[id] & declared; }
+  bool is_constant(int id) const { return flags[id] & constant; }
+
+  int size() const { return names.size(); } // number of interned names
+
+protected:
+  void declare(int id); // checking that it wasn't
+  void make_constant(int id) { flags[id] |= constant; }
+
+private:
+  struct Slot {
+    unsigned hash;
+    int index; // symbol id, or empty
+  };
+  static constexpr int empty = -1;
+  static constexpr int initial_capacity = 64; // must be a power of two
+  enum Flag : char {
+    declared = 1, // a "let" (or define_name()) has given it a value
+    constant = 2, // declared, and can never change
+  };
+
+  // in order of interning; index == symbol id
+  vector<string> names;
+  vector<char> flags;
+  vector<Slot> slots; // open-addressing index into names
+  int live{0};        // number of occupied slots
+
+  static unsigned hash_of(string_view s);
+  int probe(string_view s, unsigned h) const; // slot for s (maybe empty)
+  int add(int slot, unsigned h, string &&s); // s goes where probe() said
+  void grow();
+};
+
+template <class T> class Basic_symbol_table : public Symbol_names {
+public:
+  using value_type = T;
+
+  T get(int id) const;            // value of a declared variable
+  void set(int id, T d);          // assign to a declared variable
+  T define(int id, T d);          // declare id with initial value d
+  T define_constant(int id, T d); // declare id for good
+
+  // the value of id, which the caller knows is declared
+  T value(int id) const { return values[id]; }
+  // all of them, by symbol id; moves when a variable is declared
+  const T *value_array() const { return values.data(); }
+  // changes whenever id is given a value (by define(), set())
+  uint64_t generation(int id) const { return generations[id]; }
+
+private:
+  // by symbol id, up to the last one declared
+  vector<T> values;
+  vector<uint64_t> generations;
+};
+
+using Symbol_table = Basic_symbol_table<double>;
+
+// FNV-1a: cheap and good enough for identifiers
+inline unsigned Symbol_names::hash_of(string_view s) {
+  unsigned h = 2166136261u;
+  for (char c : s) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// find the slot holding s, or the empty slot where s would go
+inline int Symbol_names::probe(string_view s, unsigned h) const {
+  const unsigned mask = slots.size() - 1;
+  CALC_COUNT(lookups);
+  for (unsigned i = h & mask;; i = (i + 1) & mask) {
+    CALC_COUNT(probe_steps);
+    const Slot &sl = slots[i];
+    if (sl.index == empty)
+      return i;
+    if (sl.hash == h && names[sl.index] == s) {
+      CALC_COUNT(lookup_hits);
+      return i;
+    }
+  }
+}
+
+// double the index and re-insert every name; symbol ids don't change
+inline void Symbol_names::grow() {
+  vector<Slot> old(slots.size() * 2, Slot{0, empty});
+  swap(old, slots);
+  const unsigned mask = slots.size() - 1;
+  for (const Slot &sl : old) {
+    if (sl.index == empty)
+      continue;
+    unsigned i = sl.hash & mask;
+    while (slots[i].index != empty)
+      i = (i + 1) & mask;
+    slots[i] = sl;
+  }
+}
+
+inline int Symbol_names::add(int slot, unsigned h, string &&s) {
+  if (2 * (live + 1) > int(slots.size())) { // keep the load factor <= 1/2
+    grow();
+    slot = probe(s, h);
+  }
+  slots[slot] = Slot{h, int(names.size())};
+  ++live;
+  names.push_back(move(s));
+  flags.push_back(0);
+  return slots[slot].index;
+}
+
+inline int Symbol_names::intern(string_view s) {
+  const unsigned h = hash_of(s);
+  const int i = probe(s, h);
+  if (slots[i].index != empty)
+    return slots[i].index;
+  return add(i, h, string(s));
+}
+
+inline int Symbol_names::intern(string &&s) {
+  const unsigned h = hash_of(s);
+  const int i = probe(s, h);
+  if (slots[i].index != empty)
+    return slots[i].index;
+  return add(i, h, move(s));
+}
+
+inline int Symbol_names::find(string_view s) const {
+  return slots[probe(s, hash_of(s))].index;
+}
+
+inline void Symbol_names::declare(int id) {
+  if (is_declared(id))
+    error(names[id], " declared twice");
+  flags[id] |= declared;
+}
+
+template <class T> T Basic_symbol_table<T>::get(int id) const {
+  if (!is_declared(id))
+    error("get: undefined variable ", name(id));
+  return values[id];
+}
+
+template <class T> void Basic_symbol_table<T>::set(int id, T d) {
+  if (!is_declared(id))
+    error("set: undefined variable ", name(id));
+  if (is_constant(id))
+    error("set: can't assign to constant ", name(id));
+  values[id] = d;
+  ++generations[id];
+}
+
+template <class T> T Basic_symbol_table<T>::define(int id, T d) {
+  declare(id);
+  if (id >= int(values.size())) {
+    values.resize(id + 1, T(0));
+    generations.resize(id + 1, 0);
+  }
+  values[id] = d;
+  ++generations[id];
+  return d;
+}
+
+template <class T> T Basic_symbol_table<T>::define_constant(int id, T d) {
+  define(id, d);
+  make_constant(id);
+  return d;
+}
+
+// the traditional by-name interface to a table
+
+// return the value of the variable named s
+template <class T>
+T get_value(const Basic_symbol_table<T> &st, string_view s) {
+  int id = st.find(s);
+  if (id < 0)
+    error("get: undefined variable ", string(s));
+  return st.get(id);
+}
+
+// set the variable named s to d
+template <class T>
+void set_value(Basic_symbol_table<T> &st, string_view s,
+               typename Basic_symbol_table<T>::value_type d) {
+  int id = st.find(s);
+  if (id < 0)
+    error("set: undefined variable ", string(s));
+  st.set(id, d);
+}
+
+// is var declared in st
+inline bool is_declared(const Symbol_names &st, string_view var) {
+  int id = st.find(var);
+  return id >= 0 && st.is_declared(id);
+}
+
+// add { var, val } to st
+template <class T>
+T define_name(Basic_symbol_table<T> &st, string_view var,
+              typename Basic_symbol_table<T>::value_type val) {
+  return st.define(st.intern(var), val);
+}
+
+// add { var, val } to st; var can never change
+template <class T>
+T define_constant(Basic_symbol_table<T> &st, string_view var,
+                  typename Basic_symbol_table<T>::value_type val) {
+  return st.define_constant(st.intern(var), val);
+}
+
+#endif // SYMBOL_TABLE_H
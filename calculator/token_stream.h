@@ -0,0 +1,396 @@
+/*
+ * token_stream.h
+ *
+ * Tokens and the Token_stream that reads them.
+ *
+ * The Token_stream does not read its input a character at a time through
+ * operator>>; it pulls text into a buffer and scans it with plain pointers.
+ * Numbers are converted with parse_number() (see numbers.h), which gives
+ * what from_chars() would, without locale work and mostly faster.
+ *
+ * The buffer is refilled in one of two ways:
+ *   line:  one line per refill, for interactive use, so that a prompt is
+ *          answered as soon as the user hits return.
+ *   block: as many characters as fit, for input from files and pipes.
+ * Both produce exactly the same tokens. A Token_stream can also scan text
+ * that is all in memory already (a mapped file, see mapped_file.h): then
+ * there is no buffer and nothing is copied; the text is scanned in place
+ * and names are looked up straight from it. Or it can take tokens that
+ * were scanned somewhere else, from a Token_source (see pipeline.h).
+ *
+ * Names are interned in a Symbol_names as they are read, and a name Token
+ * carries the symbol id rather than the characters, so a Token is a small
+ * trivially copyable value and reading a name allocates nothing (once the
+ * name has been seen).
+ *
+ * A number Token carries its literal as a Compensated. Its hi is the
+ * literal as a double; only a wide Token_stream (set_wide(), for
+ * arithmetic wider than double) works out the lo as well, since that costs
+ * more than the double alone.
+ */
+#ifndef TOKEN_STREAM_H
+#define TOKEN_STREAM_H
+
+#include "../lib/std_lib_facilities.h"
+#include "number.h"
+#include "numbers.h"
+#include "stats.h"
+#include "symbol_table.h"
+#include <charconv>
+#include <cstring>
+
+const char number = '8'; // t.kind == number means that t is a number Token
+const char quit = 'q';   // t.kind == quit means that t is a quit Token
+const char print = ';';  // t.kind == print means that t is a print Token
+const char name = 'a';        // name token
+const char let = 'L';         // declaration token
+const char bad = '?';         // input that makes no Token
+constexpr string_view declkey = "let"; // declaration key
+
+/**
+ * A conventional way of reading stuff from input and store it
+ * in a way that lets us look at it in convenient ways. 'tokenize'
+ */
+class Token {
+public:
+  char kind;
+  int id;            // for a name: its symbol id in the Token_stream's table
+  Compensated value; // for a number
+  Token() : kind{0}, id{-1}, value{0.0} {}
+  Token(char k) : kind{k}, id{-1}, value{0.0} {}
+  Token(char k, double v) : kind{k}, id{-1}, value{v} {}
+  Token(Compensated v) : kind{number}, id{-1}, value{v} {}
+  Token(char ch, int sym) : kind{ch}, id{sym}, value{0.0} {}
+};
+
+static_assert(is_trivially_copyable<Token>::value,
+              "Tokens are copied around freely");
+
+/**
+ * Tokens scanned somewhere else (on another thread, say), for a
+ * Token_stream to hand out: the Token_stream then does no scanning of its
+ * own, and skips (ignore()) by tokens rather than by characters. That
+ * comes to the same, since no token has a ';' in it.
+ */
+class Token_source {
+public:
+  virtual ~Token_source() = default;
+
+  // the next token and its input offset; false (and a quit) at the end
+  virtual bool next(Token &t, long &where) = 0;
+};
+
+/**
+ * A stream that produces a token when we ask for one using get() and where we
+ * can put a token back into the stream using putback().
+ *
+ * Up to lookahead tokens can be held at once: peek(k) looks k tokens ahead
+ * without consuming anything, and several tokens can be put back (the last
+ * one put back is the next one got). They are kept in a small ring buffer
+ * inside the Token_stream, so none of this allocates.
+ *
+ * When the input runs out, get() returns a quit Token. Characters that make
+ * no token come out as a bad Token; it is up to the parser to complain.
+ * The stream also knows where in the input each token started, for error
+ * reports.
+ */
+class Token_stream {
+public:
+  enum class Mode { line, block };
+  static constexpr int block_size = 64 * 1024;
+
+  // capacity: the buffer's size to start with; it grows to hold a token
+  // that doesn't fit
+  explicit Token_stream(Symbol_names &st, istream &is = cin,
+                        Mode m = Mode::line, int capacity = block_size);
+  Token_stream(Symbol_names &st, string_view all); // the whole input
+  Token_stream(Symbol_names &st, Token_source &src);
+
+  static constexpr int lookahead = 4; // must be a power of two
+
+  Token get();                  // get a token
+  const Token &peek(int k = 0); // the token k places ahead; k < lookahead
+  void putback(Token t);        // put a token back
+  bool ignore(char c);          // discard characters up to and including a c
+                                // (false if the input ran out first)
+
+  long position() const { return last; } // offset of the last token got
+  long next_position();                  // offset of the next token
+
+  void set_mode(Mode m) { mode = m; }
+  void set_wide(bool w) { wide = w; } // literals to about 32 digits
+
+private:
+  Symbol_names &names;           // where names are interned
+  istream *in;                   // nullptr: the input is in [first,end) ...
+  Token_source *source{nullptr}; // ... or comes from here
+  Mode mode;
+  bool wide{false};
+  vector<char> text;          // the buffer; [cur,end) is not yet scanned
+  const char *first{nullptr}; // the start of the buffer, or of the input
+  const char *cur{nullptr};
+  const char *end{nullptr};
+
+  long base{0}; // input offset of *first
+
+  Token buffer[lookahead]; // tokens read but not yet got, from head on
+  long where[lookahead];   // ... and their offsets in the input
+  int head{0};
+  int count{0};
+  long last{0};    // offset of the token got last
+  long scanned{0}; // offset of the token scanned last
+
+  Token scan();             // the next Token, counted (see stats.h)
+  Token compose();          // compose a Token from the characters in text
+  bool fill();              // read more; keeps [cur,end). false if no more
+  bool skip_whitespace();   // false if the input ran out
+  const char *number_end(); // end of the literal starting at cur
+  const char *name_end();   // end of the name starting at cur
+};
+
+inline Token_stream::Token_stream(Symbol_names &st, istream &is, Mode m,
+                                  int capacity)
+    : names{st}, in{&is}, mode{m}, text(max(capacity, 1)) {
+  first = cur = end = text.data();
+}
+
+inline Token_stream::Token_stream(Symbol_names &st, string_view all)
+    : names{st}, in{nullptr}, mode{Mode::block} {
+  first = cur = all.data();
+  end = cur + all.size();
+}
+
+inline Token_stream::Token_stream(Symbol_names &st, Token_source &src)
+    : names{st}, in{nullptr}, source{&src}, mode{Mode::block} {}
+
+inline Token Token_stream::get() {
+  // check if we already have a Token ready
+  if (count > 0) {
+    Token t = buffer[head];
+    last = where[head];
+    head = (head + 1) & (lookahead - 1);
+    --count;
+    return t;
+  }
+  Token t = scan();
+  last = scanned;
+  return t;
+}
+
+inline const Token &Token_stream::peek(int k) {
+  if (k >= lookahead)
+    error("peek() beyond the lookahead buffer");
+  while (count <= k) {
+    const int i = (head + count) & (lookahead - 1);
+    buffer[i] = scan();
+    where[i] = scanned;
+    ++count;
+  }
+  return buffer[(head + k) & (lookahead - 1)];
+}
+
+inline void Token_stream::putback(Token t) {
+  CALC_COUNT(putbacks);
+  if (count == lookahead)
+    error("putback() into a full buffer");
+  head = (head - 1) & (lookahead - 1);
+  buffer[head] = t;
+  where[head] = last;
+  ++count;
+}
+
+inline long Token_stream::next_position() {
+  peek();
+  return where[head];
+}
+
+// move the unread characters to the front of the buffer and append more
+inline bool Token_stream::fill() {
+  if (!in)
+    return false;
+  const int left = end - cur;
+  base += cur - first;
+  memmove(text.data(), cur, left);
+  if (left == int(text.size())) // one token fills the whole buffer
+    text.resize(text.size() * 2);
+  char *p = text.data() + left;
+  int room = text.size() - left;
+  int got = 0;
+
+  if (mode == Mode::line) {
+    string line;
+    if (getline(*in, line)) {
+      line += '\n';
+      if (int(line.size()) > room) {
+        text.resize(left + line.size());
+        p = text.data() + left;
+      }
+      memcpy(p, line.data(), line.size());
+      got = line.size();
+    }
+  } else {
+    in->read(p, room);
+    got = in->gcount();
+  }
+
+  first = cur = text.data();
+  end = cur + left + got;
+  return got > 0;
+}
+
+inline bool Token_stream::skip_whitespace() {
+  for (;;) {
+    while (cur < end && isspace(static_cast<unsigned char>(*cur)))
+      ++cur;
+    if (cur < end)
+      return true;
+    if (!fill())
+      return false;
+  }
+}
+
+// a literal is digits and dots, optionally followed by an exponent: the
+// same characters operator>> would have taken for a double
+inline const char *Token_stream::number_end() {
+  for (;;) {
+    const char *p = digits_end(cur, end);
+    while (p < end && *p == '.')
+      p = digits_end(p + 1, end);
+    if (p < end && (*p == 'e' || *p == 'E')) {
+      ++p;
+      if (p < end && (*p == '+' || *p == '-'))
+        ++p;
+      p = digits_end(p, end);
+    }
+    if (p < end) // otherwise the literal might go on in the next block
+      return p;
+    if (!fill())
+      return end;
+  }
+}
+
+inline const char *Token_stream::name_end() {
+  for (;;) {
+    const char *p = cur + 1;
+    while (p < end && isalnum(static_cast<unsigned char>(*p)))
+      ++p;
+    if (p < end)
+      return p;
+    if (!fill())
+      return end;
+  }
+}
+
+inline Token Token_stream::scan() {
+  if (source) { // counted where it was scanned
+    Token t;
+    source->next(t, scanned);
+    return t;
+  }
+  CALC_SPAN(lexing);
+  Token t = compose();
+  CALC_COUNT_TOKEN(t.kind);
+  return t;
+}
+
+// scan the buffer and compose a Token
+inline Token Token_stream::compose() {
+  const bool more = skip_whitespace();
+  scanned = base + (cur - first);
+  if (!more)
+    return Token{quit}; // end of input
+  char ch = *cur;
+  switch (ch) {
+  case print: // for "print"
+  case quit:  // for "quit"
+  case '=':   // for declaration and assignment
+  case '(':
+  case ')':
+  case '+':
+  case '-':
+  case '*':
+  case '/':
+  case '%':
+    ++cur;
+    return Token{ch}; // let each character represent itself
+  case '.':           // a floating-point-literal can start with a dot
+  case '0':
+  case '1':
+  case '2':
+  case '3':
+  case '4':
+  case '5':
+  case '6':
+  case '7':
+  case '8':
+  case '9': {
+    const char *stop = number_end();
+    Compensated val;
+    from_chars_result r = wide ? parse_number(cur, stop, val)
+                               : parse_number(cur, stop, val.hi);
+    if (r.ec != errc{}) {
+      cur = stop;
+      return Token{bad};
+    }
+    cur = r.ptr;
+    return Token{val};
+  }
+  default:
+    if (isalpha(static_cast<unsigned char>(ch))) {
+      const char *stop = name_end();
+      const string_view spelling(cur, stop - cur);
+      cur = stop;
+      if (spelling == declkey)
+        return Token{let}; // decalration keyword
+      return Token{name, names.intern(spelling)};
+    }
+    ++cur;
+    return Token{bad};
+  }
+}
+
+inline bool Token_stream::ignore(char c) {
+  // first look in buffer:
+  while (count > 0) {
+    char k = buffer[head].kind;
+    head = (head + 1) & (lookahead - 1);
+    --count;
+    if (k == c)
+      return true;
+  }
+  if (source) {
+    Token t;
+    while (source->next(t, scanned))
+      if (t.kind == c)
+        return true;
+    return false;
+  }
+  // now search the input, a buffer at a time: what ignore() skips is never
+  // made into tokens, so a c is a c wherever it is
+  for (;;) {
+    if (const void *p = memchr(cur, c, end - cur)) {
+      cur = static_cast<const char *>(p) + 1;
+      return true;
+    }
+    cur = end; // nothing here is worth keeping
+    if (!fill())
+      return false;
+  }
+}
+
+// all the tokens of text, up to and including the quit at its end, and
+// where each starts; in one pass, for a caller that wants them all at once
+inline void tokenize(string_view text, Symbol_names &st, vector<Token> &tokens,
+                     vector<long> &where) {
+  Token_stream ts{st, text};
+  tokens.clear();
+  where.clear();
+  tokens.reserve(text.size() / 4 + 1); // about what dense numeric text has
+  where.reserve(text.size() / 4 + 1);
+  do {
+    tokens.push_back(ts.get());
+    where.push_back(ts.position());
+  } while (tokens.back().kind != quit);
+}
+
+#endif // TOKEN_STREAM_H
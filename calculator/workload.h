@@ -0,0 +1,143 @@
+/*
+ * workload.h
+ *
+ * Random calculator scripts, for benchmarks.
+ *
+ * The scripts follow the grammar at the top of calculator00.cpp: "let"
+ * declarations and expressions with nested parentheses, unary minus and
+ * plus, and all of + - * / %. Expressions only use variables that have
+ * already been declared, and divisors are nonzero numbers (or pi or e),
+ * so the statements succeed and every declared variable really exists.
+ *
+ * The numbers come from randint(), so a script is fixed by the seed. Each
+ * thread has an engine of its own, so threads can write scripts at once;
+ * give each its own stream number and the scripts it writes are fixed by
+ * the seed and the stream.
+ */
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include "../lib/std_lib_facilities.h"
+
+class Workload {
+public:
+  int max_depth{3};    // how deeply parentheses nest
+  int max_terms{3};    // terms per expression, factors per term
+  int let_percent{25}; // share of statements that are declarations
+
+  // vs: the variables expressions may use before any are declared
+  explicit Workload(int seed, vector<string> vs = {"pi", "e"}) : vars{vs} {
+    seed_randint(seed);
+  }
+  // for this thread's stream number stream (see seed_randint())
+  Workload(int seed, int stream, vector<string> vs = {"pi", "e"})
+      : vars{vs} {
+    seed_randint(seed, stream);
+  }
+
+  string expression(int depth = 0); // one random Expression
+  string script(int statements);    // that many Statements, one per line
+
+  const vector<string> &variables() const { return vars; }
+
+private:
+  vector<string> vars; // the names declared so far
+
+  void add_expression(string &s, int depth);
+  void add_term(string &s, int depth);
+  void add_primary(string &s, int depth, bool divisor);
+  void add_number(string &s, bool divisor);
+};
+
+inline void Workload::add_number(string &s, bool divisor) {
+  switch (randint(3)) {
+  case 0: // a small integer
+    s += to_string(randint(divisor ? 1 : 0, 99));
+    break;
+  case 1: // a decimal fraction
+    s += to_string(randint(divisor ? 1 : 0, 999));
+    s += '.';
+    s += to_string(randint(1, 99));
+    break;
+  case 2: // a leading-dot literal
+    s += '.';
+    s += to_string(randint(1, 999));
+    break;
+  default: // with an exponent
+    s += to_string(randint(1, 9));
+    s += 'e';
+    s += to_string(randint(-3, 3));
+  }
+}
+
+inline void Workload::add_primary(string &s, int depth, bool divisor) {
+  if (divisor) { // something we know isn't zero
+    if (randint(3) == 0)
+      s += randint(1) ? "pi" : "e";
+    else
+      add_number(s, true);
+    return;
+  }
+  switch (randint(depth < max_depth ? 5 : 3)) {
+  case 0:
+  case 1:
+    add_number(s, divisor);
+    break;
+  case 2:
+  case 3:
+    s += vars[randint(vars.size() - 1)];
+    break;
+  case 4:
+    s += '(';
+    add_expression(s, depth + 1);
+    s += ')';
+    break;
+  default: // unary minus or plus
+    s += randint(1) ? '-' : '+';
+    add_primary(s, depth + 1, divisor);
+  }
+}
+
+inline void Workload::add_term(string &s, int depth) {
+  add_primary(s, depth, false);
+  for (int n = randint(max_terms - 1); n > 0; --n) {
+    const char ops[] = "*/%";
+    const char op = ops[randint(2)];
+    s += ' ';
+    s += op;
+    s += ' ';
+    add_primary(s, depth, op != '*');
+  }
+}
+
+inline void Workload::add_expression(string &s, int depth) {
+  add_term(s, depth);
+  for (int n = randint(max_terms - 1); n > 0; --n) {
+    s += randint(1) ? " + " : " - ";
+    add_term(s, depth);
+  }
+}
+
+inline string Workload::expression(int depth) {
+  string s;
+  add_expression(s, depth);
+  return s;
+}
+
+inline string Workload::script(int statements) {
+  string s;
+  for (int i = 0; i < statements; ++i) {
+    if (randint(99) < let_percent) {
+      string v = "v" + to_string(vars.size());
+      s += "let " + v + " = ";
+      add_expression(s, 0);
+      vars.push_back(v);
+    } else {
+      add_expression(s, 0);
+    }
+    s += ";\n";
+  }
+  return s;
+}
+
+#endif // WORKLOAD_H
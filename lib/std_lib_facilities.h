@@ -20,7 +20,10 @@ Revised November 25 2013: remove support for pre-C++11 compilers, use C++11:
 <chrono> Revised November 28 2013: add a few container algorithms Revised June 8
 2014: added #ifndef to workaround Microsoft C++11 weakness Revised Febrary 2
 2015: randint() can now be seeded (see exercise 5.13). Revised August 3, 2020: a
-cleanup removing support for ancient compilers
+cleanup removing support for ancient compilers. Revised: range checking of
+Vector and String can be compiled out (PPP_UNCHECKED/NDEBUG); checked()
+for opt-in iterator checking. Revised: randint() engines are per thread;
+seed_randint(s, stream) and a randint() that fills a range
 */
 
 #ifndef H112
@@ -31,6 +34,7 @@ cleanup removing support for ancient compilers
 #include <cmath>
 #include <cstdlib>
 #include <forward_list>
+#include <iterator>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -62,6 +66,20 @@ struct Range_error : out_of_range { // enhanced vector range error reporting
   Range_error(int i) : out_of_range("Range error: " + to_string(i)), index(i) {}
 };
 
+// Range checking
+// By default Vector and String check every subscript, so that a bad index
+// throws a Range_error instead of corrupting memory. A release build can
+// turn the checks off: define PPP_UNCHECKED (or NDEBUG, unless PPP_CHECKED
+// is also defined) and vector and String are plain std::vector and
+// std::string, with nothing between operator[] and the element.
+#if defined(PPP_UNCHECKED) || (defined(NDEBUG) && !defined(PPP_CHECKED))
+#define PPP_RANGE_CHECK 0
+#else
+#define PPP_RANGE_CHECK 1
+#endif
+
+#if PPP_RANGE_CHECK
+
 // trivially range-checked vector (no iterator checking):
 template <class T> struct Vector : public std::vector<T> {
   using size_type = typename std::vector<T>::size_type;
@@ -77,36 +95,44 @@ template <class T> struct Vector : public std::vector<T> {
   */
   using std::vector<T>::vector; // inheriting constructor
 
-  T &operator[](unsigned int i) // rather than return at(i);
+  T &operator[](size_type i) // rather than return at(i);
   {
-    if (i < 0 || this->size() <= i)
+    if (this->size() <= i)
       throw Range_error(i);
     return std::vector<T>::operator[](i);
   }
-  const T &operator[](unsigned int i) const {
-    if (i < 0 || this->size() <= i)
+  const T &operator[](size_type i) const {
+    if (this->size() <= i)
       throw Range_error(i);
     return std::vector<T>::operator[](i);
   }
 };
 
+#else
+
+template <class T> using Vector = std::vector<T>;
+
+#endif // PPP_RANGE_CHECK
+
 // disgusting macro hack to get a range checked vector:
 #define vector Vector
 
+#if PPP_RANGE_CHECK
+
 // trivially range-checked string (no iterator checking):
 struct String : std::string {
   using size_type = std::string::size_type;
   //	using string::string;
 
-  char &operator[](unsigned int i) // rather than return at(i);
+  char &operator[](size_type i) // rather than return at(i);
   {
-    if (i < 0 || size() <= i)
+    if (size() <= i)
       throw Range_error(i);
     return std::string::operator[](i);
   }
 
-  const char &operator[](unsigned int i) const {
-    if (i < 0 || size() <= i)
+  const char &operator[](size_type i) const {
+    if (size() <= i)
       throw Range_error(i);
     return std::string::operator[](i);
   }
@@ -120,6 +146,105 @@ template <> struct hash<String> {
 
 } // namespace std
 
+#else
+
+using String = std::string;
+
+#endif // PPP_RANGE_CHECK
+
+// range-checked iteration, to be asked for explicitly:
+//         for (double d : checked(v)) ...
+// throws Range_error on an attempt to use an iterator outside [begin,end);
+// the check is there whether or not PPP_RANGE_CHECK is
+template <class I> class Checked_iterator {
+public:
+  using iterator_category = std::random_access_iterator_tag;
+  using value_type = typename std::iterator_traits<I>::value_type;
+  using difference_type = typename std::iterator_traits<I>::difference_type;
+  using pointer = typename std::iterator_traits<I>::pointer;
+  using reference = typename std::iterator_traits<I>::reference;
+
+  Checked_iterator(I first, I last, I p) : first{first}, last{last}, p{p} {}
+
+  reference operator*() const {
+    check(p);
+    return *p;
+  }
+  pointer operator->() const {
+    check(p);
+    return &*p;
+  }
+  reference operator[](difference_type n) const {
+    check(p + n);
+    return p[n];
+  }
+
+  Checked_iterator &operator++() {
+    ++p;
+    return *this;
+  }
+  Checked_iterator &operator--() {
+    --p;
+    return *this;
+  }
+  Checked_iterator operator++(int) {
+    Checked_iterator r = *this;
+    ++p;
+    return r;
+  }
+  Checked_iterator operator--(int) {
+    Checked_iterator r = *this;
+    --p;
+    return r;
+  }
+  Checked_iterator &operator+=(difference_type n) {
+    p += n;
+    return *this;
+  }
+  Checked_iterator &operator-=(difference_type n) {
+    p -= n;
+    return *this;
+  }
+  Checked_iterator operator+(difference_type n) const {
+    return Checked_iterator{first, last, p + n};
+  }
+  Checked_iterator operator-(difference_type n) const {
+    return Checked_iterator{first, last, p - n};
+  }
+  difference_type operator-(const Checked_iterator &q) const {
+    return p - q.p;
+  }
+
+  bool operator==(const Checked_iterator &q) const { return p == q.p; }
+  bool operator!=(const Checked_iterator &q) const { return p != q.p; }
+  bool operator<(const Checked_iterator &q) const { return p < q.p; }
+  bool operator>(const Checked_iterator &q) const { return p > q.p; }
+  bool operator<=(const Checked_iterator &q) const { return p <= q.p; }
+  bool operator>=(const Checked_iterator &q) const { return p >= q.p; }
+
+private:
+  I first, last, p;
+
+  void check(I q) const {
+    if (q - first < 0 || last - q <= 0)
+      throw Range_error(int(q - first));
+  }
+};
+
+template <class I> struct Checked_range {
+  Checked_iterator<I> b, e;
+  Checked_iterator<I> begin() const { return b; }
+  Checked_iterator<I> end() const { return e; }
+};
+
+template <class C> auto checked(C &c) -> Checked_range<decltype(c.begin())> {
+  using I = decltype(c.begin());
+  I first = c.begin();
+  I last = c.end();
+  return {Checked_iterator<I>{first, last, first},
+          Checked_iterator<I>{first, last, last}};
+}
+
 struct Exit : runtime_error {
   Exit() : runtime_error("Exit") {}
 };
@@ -187,19 +312,40 @@ template <class R, class A> R narrow_cast(const A &a) {
 
 // random number generators. See 24.7.
 
+// each thread has an engine of its own, so randint() can be used from many
+// threads at once without locking; a thread that is never seeded starts
+// from the engine's default seed, like the single engine used to
 inline default_random_engine &get_rand() {
-  static default_random_engine ran; // note: not thread_local
+  thread_local default_random_engine ran;
   return ran;
 };
 
+// seed this thread's engine
 inline void seed_randint(int s) { get_rand().seed(s); }
 
+// seed this thread's engine for stream number stream: each stream gets a
+// different, reproducible sequence for the same s, so that thread i can
+// use stream i and a parallel run gives the same numbers every time
+inline void seed_randint(int s, int stream) {
+  seed_seq seq{s, stream};
+  get_rand().seed(seq);
+}
+
 inline int randint(int min, int max) {
   return uniform_int_distribution<>{min, max}(get_rand());
 }
 
 inline int randint(int max) { return randint(0, max); }
 
+// fill [first,last) with random ints in [min,max], with a single
+// distribution object for the lot
+template <class I> void randint(I first, I last, int min, int max) {
+  uniform_int_distribution<> dist{min, max};
+  default_random_engine &ran = get_rand();
+  for (; first != last; ++first)
+    *first = dist(ran);
+}
+
 // inline double sqrt(int x) { return sqrt(double(x)); }	// to match
 // C++0x
 